@@ -0,0 +1,66 @@
+#!/bin/bash
+
+function create_config {
+    echo "iterations           = 2000" > config.txt
+    echo "width                = $1" >> config.txt
+    echo "height               = $2" >> config.txt
+    echo "obstacle_x           = 0.0" >> config.txt
+    echo "obstacle_y           = 0.0" >> config.txt
+    echo "obstacle_r           = 0.0" >> config.txt
+    echo "reynolds             = 100" >> config.txt
+    echo "inflow_max_velocity  = 0.100000" >> config.txt
+    echo "output_filename      = results.raw" >> config.txt
+    echo "write_interval       = 100000" >> config.txt
+    echo "halo_backend         = $3" >> config.txt
+}
+
+function get_loop_latency {
+    echo "$(grep "Global average loop latency:" $1 | awk '{print $5}' | sed -e "s/ms//g")"
+}
+
+start=$(date +%s.%N)
+
+mkdir -p benchmarks/ tmp/
+bin=$1
+mpicmd=$2
+flags="$(shift 2; echo "$*")"
+if [ "$mpicmd" = "mpiexec" ] || [ "$mpicmd" = "mpirun" ] || [ "$mpicmd" = "mpcrun" ]; then
+    :
+else
+    printf "\033[1;31merror:\033[0m MPI command \`%s\` is unknown.\n" $mpicmd
+    exit 1
+fi
+
+bench=benchmarks/bench_halo.dat
+rm -f $bench
+
+backends="p2p neighbor persistent shared"
+
+printf "\033[1;34m==>\033[0m Comparing halo exchange backends (\033[35m%s\033[0m)...\n" $bin
+echo "# processes $(for b in $backends; do printf "%s_loop_latency_ms " $b; done)" >> $bench
+for processes in 2 4 8; do
+    printf "Running with \033[1;33m%d\033[0m processes... " $processes
+
+    line="$processes"
+    summary=""
+    for backend in $backends; do
+        # Small square domain: latency-bound, 2D grid for large process counts
+        create_config 200 200 $backend
+        OMP_NUM_THREADS=1 $mpicmd -n $processes $flags $bin > tmp/run_$backend.out
+        latency=$(get_loop_latency tmp/run_$backend.out)
+        line="$line $latency"
+        summary="$summary $backend: \033[36m${latency}ms\033[0m,"
+    done
+
+    echo "$line" >> $bench
+    printf "\033[1;32mdone\033[0m (%b per step)\n" "${summary:1:-1}"
+done
+
+printf "\033[1;32m[+]\033[0m %s\n" "$(pwd)/$bench"
+rm -rf tmp/
+
+end=$(date +%s.%N)
+elapsed=$(echo "scale=4; $end - $start" | bc -l)
+printf "\nFinished running benchmarks in \033[36m%.2fs\033[0m.\n" $elapsed
+
+exit 0
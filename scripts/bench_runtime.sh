@@ -0,0 +1,62 @@
+#!/bin/bash
+
+function create_config {
+    echo "iterations           = 4000" > config.txt
+    echo "width                = $1" >> config.txt
+    echo "height               = $2" >> config.txt
+    echo "obstacle_x           = 0.0" >> config.txt
+    echo "obstacle_y           = 0.0" >> config.txt
+    echo "obstacle_r           = 0.0" >> config.txt
+    echo "reynolds             = 100" >> config.txt
+    echo "inflow_max_velocity  = 0.100000" >> config.txt
+    echo "output_filename      = results.raw" >> config.txt
+    echo "write_interval       = 100000" >> config.txt
+}
+
+function get_loop_latency {
+    echo "$(grep "Global average loop latency:" $1 | awk '{print $5}' | sed -e "s/ms//g")"
+}
+
+start=$(date +%s.%N)
+
+mkdir -p benchmarks/ tmp/
+omp_bin=$1
+pool_bin=$2
+mpicmd=$3
+flags="$(shift 3; echo "$*")"
+if [ "$mpicmd" = "mpiexec" ] || [ "$mpicmd" = "mpirun" ] || [ "$mpicmd" = "mpcrun" ]; then
+    :
+else
+    printf "\033[1;31merror:\033[0m MPI command \`%s\` is unknown.\n" $mpicmd
+    exit 1
+fi
+
+nb_cores=$(nproc)
+bench=benchmarks/bench_runtime.dat
+rm -f $bench
+
+# Small subdomains so that synchronisations dominate
+create_config 400 80
+
+printf "\033[1;34m==>\033[0m Comparing \033[1mOpenMP\033[0m (\033[35m%s\033[0m) and \033[1mthread pool\033[0m (\033[35m%s\033[0m) runtimes...\n" $omp_bin $pool_bin
+echo "# threads omp_loop_latency_ms pool_loop_latency_ms" >> $bench
+for (( threads=1; threads<=$nb_cores; threads*=2 )); do
+    printf "Running with \033[1;33m%d\033[0m threads... " $threads
+
+    OMP_NUM_THREADS=$threads OMP_PROC_BIND=close $mpicmd -n 1 $flags $omp_bin > tmp/run_omp.out
+    OMP_NUM_THREADS=$threads $mpicmd -n 1 $flags $pool_bin > tmp/run_pool.out
+    omp_latency=$(get_loop_latency tmp/run_omp.out)
+    pool_latency=$(get_loop_latency tmp/run_pool.out)
+
+    echo "$threads $omp_latency $pool_latency" >> $bench
+    printf "\033[1;32mdone\033[0m (OpenMP: \033[36m%sms\033[0m, pool: \033[36m%sms\033[0m per step)\n" $omp_latency $pool_latency
+done
+
+printf "\033[1;32m[+]\033[0m %s\n" "$(pwd)/$bench"
+rm -rf tmp/
+
+end=$(date +%s.%N)
+elapsed=$(echo "scale=4; $end - $start" | bc -l)
+printf "\nFinished running benchmarks in \033[36m%.2fs\033[0m.\n" $elapsed
+
+exit 0
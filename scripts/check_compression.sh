@@ -0,0 +1,101 @@
+#!/bin/bash
+
+function create_config {
+    echo "iterations           = 2000" > tmp/config.txt
+    echo "width                = 400" >> tmp/config.txt
+    echo "height               = 100" >> tmp/config.txt
+    echo "obstacle_x           = 100.0" >> tmp/config.txt
+    echo "obstacle_y           = 50.0" >> tmp/config.txt
+    echo "obstacle_r           = 12.0" >> tmp/config.txt
+    echo "reynolds             = 100" >> tmp/config.txt
+    echo "inflow_max_velocity  = 0.100000" >> tmp/config.txt
+    echo "output_filename      = $2" >> tmp/config.txt
+    echo "write_interval       = 100" >> tmp/config.txt
+    echo "output_compression   = $1" >> tmp/config.txt
+    echo "output_buffers       = $3" >> tmp/config.txt
+    echo "output_error_bound   = ${4:-1e-5}" >> tmp/config.txt
+}
+
+# Largest distance of the checksums of a lossy simulation to the ones of a raw
+# one, in error bounds of all the quantities, and largest error of the frames
+function max_lossy_error {
+    local frames=$(target/display --info $1 0 | awk '/frames/{print $3}')
+    local cells=$(target/display --info $1 0 | awk '/width|height/{n = (n ? n : 1) * $3} END {print n}')
+    local max=0
+    local error=0
+    for i in $(seq 0 $(($frames - 1))); do
+        local base=$(target/display --checksum $1 $i | awk '{print $3}')
+        local line=$(target/display --checksum $2 $i)
+        local sim=$(echo "$line" | awk '{print $3}')
+        # Checksums are printed with 6 significant digits
+        max=$(awk -v a=$base -v b=$sim -v n=$cells -v e=$3 -v m=$max 'BEGIN { d = a - b; if (d < 0) d = -d; d = (d - 1e-5 * a) / (2 * n * e); print (d > m) ? d : m }')
+        error=$(echo "$line" | awk -v m=$error '{ e = $NF; sub(/\)/, "", e); print (e + 0 > m + 0) ? e : m }')
+    done
+    echo "$max $error"
+}
+
+# Every frame of a file, as printed by `display`
+function dump_frames {
+    local frames=$(target/display --info $1 0 | awk '/frames/{print $3}')
+    for i in $(seq 0 $(($frames - 1))); do
+        target/display --gnuplot $1 $i
+    done
+}
+
+mkdir -p tmp/
+bin=$1
+mpicmd=$2
+flags="$(shift 2; echo "$*")"
+if [ "$mpicmd" = "mpiexec" ] || [ "$mpicmd" = "mpirun" ] || [ "$mpicmd" = "mpcrun" ]; then
+    :
+else
+    printf "\033[1;31merror:\033[0m MPI command \`%s\` is unknown.\n" $mpicmd
+    exit 1
+fi
+
+processes=4
+create_config none tmp/none.raw 0
+OMP_NUM_THREADS=1 $mpicmd -n $processes $flags $bin tmp/config.txt > tmp/run_none.out
+dump_frames tmp/none.raw > tmp/none.txt
+base_size=$(stat -c %s tmp/none.raw)
+
+code=0
+# Frames are compressed by the master, or by its writer thread
+for buffers in 0 2; do
+    printf "\033[1;34m==>\033[0m Comparing \033[35mlossless\033[0m frames (%s buffers) against raw ones... " $buffers
+    create_config lossless tmp/lossless.raw $buffers
+    OMP_NUM_THREADS=1 $mpicmd -n $processes $flags $bin tmp/config.txt > tmp/run_lossless.out
+    dump_frames tmp/lossless.raw > tmp/lossless.txt
+    size=$(stat -c %s tmp/lossless.raw)
+
+    if cmp -s tmp/none.txt tmp/lossless.txt; then
+        printf "\033[1;32mok\033[0m"
+    else
+        printf "\033[1;31mfailure\033[0m"
+        code=1
+    fi
+    printf " (\033[36m%s\033[0m bytes instead of %s, ratio \033[36m%s\033[0m)\n" \
+        $size $base_size $(awk -v a=$base_size -v b=$size 'BEGIN { printf "%.2f", a / b }')
+done
+
+# Every quantity of a lossy frame is within the error bound of the raw one
+for bound in 1e-5 1e-3; do
+    printf "\033[1;34m==>\033[0m Comparing \033[35mlossy\033[0m frames (error bound %s) against raw ones... " $bound
+    create_config lossy tmp/lossy.raw 0 $bound
+    OMP_NUM_THREADS=1 $mpicmd -n $processes $flags $bin tmp/config.txt > tmp/run_lossy.out
+    size=$(stat -c %s tmp/lossy.raw)
+    read distance error <<< $(max_lossy_error tmp/none.raw tmp/lossy.raw $bound)
+
+    if awk -v d=$distance -v e=$error -v b=$bound 'BEGIN { exit !(d <= 1 && e <= b) }'; then
+        printf "\033[1;32mok\033[0m"
+    else
+        printf "\033[1;31mfailure\033[0m"
+        code=1
+    fi
+    printf " (max error \033[36m%s\033[0m, \033[36m%s\033[0m bytes instead of %s, ratio \033[36m%s\033[0m)\n" \
+        $error $size $base_size $(awk -v a=$base_size -v b=$size 'BEGIN { printf "%.2f", a / b }')
+done
+
+rm -rf tmp/
+
+exit $code
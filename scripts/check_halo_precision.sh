@@ -0,0 +1,74 @@
+#!/bin/bash
+
+function create_config {
+    echo "iterations           = 2000" > tmp/config.txt
+    echo "width                = 200" >> tmp/config.txt
+    echo "height               = 200" >> tmp/config.txt
+    echo "obstacle_x           = 0.0" >> tmp/config.txt
+    echo "obstacle_y           = 0.0" >> tmp/config.txt
+    echo "obstacle_r           = 0.0" >> tmp/config.txt
+    echo "reynolds             = 100" >> tmp/config.txt
+    echo "inflow_max_velocity  = 0.100000" >> tmp/config.txt
+    echo "output_filename      = $2" >> tmp/config.txt
+    echo "write_interval       = 100" >> tmp/config.txt
+    echo "halo_precision       = $1" >> tmp/config.txt
+}
+
+function get_halo_bytes {
+    echo "$(grep "Global halo exchange:" $1 | awk '{print $4}')"
+}
+
+# Largest relative difference between the checksums of two simulations
+function max_relative_error {
+    local frames=$(target/display --info $1 0 | awk '/frames/{print $3}')
+    local max=0
+    for i in $(seq 0 $(($frames - 1))); do
+        local base=$(target/display --checksum $1 $i | awk '{print $3}')
+        local sim=$(target/display --checksum $2 $i | awk '{print $3}')
+        max=$(awk -v a=$base -v b=$sim -v m=$max 'BEGIN { d = (a - b) / a; if (d < 0) d = -d; print (d > m) ? d : m }')
+    done
+    echo "$max"
+}
+
+mkdir -p tmp/
+bin=$1
+mpicmd=$2
+flags="$(shift 2; echo "$*")"
+if [ "$mpicmd" = "mpiexec" ] || [ "$mpicmd" = "mpirun" ] || [ "$mpicmd" = "mpcrun" ]; then
+    :
+else
+    printf "\033[1;31merror:\033[0m MPI command \`%s\` is unknown.\n" $mpicmd
+    exit 1
+fi
+
+# Relative tolerance on the checksums, which are printed with 6 significant
+# digits: float halos must not be told apart from double ones
+declare -A tolerances=([float]=1e-6 [half]=1e-4)
+
+# 4 ranks on a square domain: both columns and rows are exchanged
+processes=4
+create_config double tmp/double.raw
+OMP_NUM_THREADS=1 $mpicmd -n $processes $flags $bin tmp/config.txt > tmp/run_double.out
+base_bytes=$(get_halo_bytes tmp/run_double.out)
+
+code=0
+for precision in float half; do
+    printf "\033[1;34m==>\033[0m Comparing \033[35m%s\033[0m halos against double ones... " $precision
+    create_config $precision tmp/$precision.raw
+    OMP_NUM_THREADS=1 $mpicmd -n $processes $flags $bin tmp/config.txt > tmp/run_$precision.out
+    bytes=$(get_halo_bytes tmp/run_$precision.out)
+    error=$(max_relative_error tmp/double.raw tmp/$precision.raw)
+
+    if awk -v e=$error -v t=${tolerances[$precision]} 'BEGIN { exit !(e <= t) }'; then
+        printf "\033[1;32mok\033[0m"
+    else
+        printf "\033[1;31mfailure\033[0m"
+        code=1
+    fi
+    printf " (max relative checksum error \033[36m%s\033[0m, tolerance %s, \033[36m%s\033[0m halo bytes instead of %s)\n" \
+        $error ${tolerances[$precision]} $bytes $base_bytes
+done
+
+rm -rf tmp/
+
+exit $code
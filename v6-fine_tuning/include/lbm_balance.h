@@ -0,0 +1,112 @@
+#ifndef LBM_BALANCE_H
+#define LBM_BALANCE_H
+
+#include "lbm_comm.h"
+#include "lbm_struct.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Imbalance (max/avg busy time) under which the columns are not moved.
+#define LBM_BALANCE_TOLERANCE 1.05
+
+/**
+ * @brief Measurement-driven load balancer of the columns of ranks.
+ *
+ * Every rank measures its busy time (step time minus the time spent waiting
+ * for the halos). Periodically, the boundaries between columns of ranks are
+ * moved so that each one gets the same share of the measured cost, and the
+ * populations and cell types of the columns changing owner are migrated
+ * between direct neighbours.
+ **/
+typedef struct lbm_balance_s {
+    /// Number of steps between two rebalancing attempts, 0 to disable.
+    uint32_t interval;
+    /// Busy time accumulated since the last rebalancing attempt.
+    double busy;
+    /// Number of steps measured since the last rebalancing attempt.
+    uint32_t steps;
+    /// Halo waiting time of the communicator at the beginning of the step.
+    double wait_before;
+    /// Imbalance measured over the first interval.
+    double first_imbalance;
+    /// Imbalance measured over the last complete interval.
+    double last_imbalance;
+    /// Number of times the boundaries were moved.
+    uint32_t nb_moves;
+    /// Number of columns received from the neighbours.
+    uint64_t migrated_columns;
+    /// Time spent rebalancing.
+    double time;
+} lbm_balance_t;
+
+/**
+ * @brief Initializes a load balancer.
+ *
+ * @param balance Load balancer to initialize.
+ * @param interval Number of steps between two rebalancing attempts.
+ **/
+void lbm_balance_init(lbm_balance_t* balance, uint32_t interval);
+
+/**
+ * @brief Marks the beginning of a measured step.
+ *
+ * @param balance Load balancer.
+ * @param mesh_comm Rank-level communicator.
+ **/
+void lbm_balance_begin_step(lbm_balance_t* balance,
+                            lbm_comm_t const* mesh_comm);
+
+/**
+ * @brief Records the duration of a step, frame saving excluded.
+ *
+ * @param balance Load balancer.
+ * @param mesh_comm Rank-level communicator.
+ * @param step_time Duration of the step.
+ **/
+void lbm_balance_end_step(lbm_balance_t* balance, lbm_comm_t const* mesh_comm,
+                          double step_time);
+
+/**
+ * @brief Computes the imbalance (max/avg busy time per step over the ranks)
+ * since the last rebalancing attempt. Collective over `mesh_comm->comm`.
+ *
+ * @param balance Load balancer.
+ * @param mesh_comm Rank-level communicator.
+ * @return The imbalance, 1 when perfectly balanced.
+ **/
+double lbm_balance_imbalance(lbm_balance_t const* balance,
+                             lbm_comm_t const* mesh_comm);
+
+/**
+ * @brief Moves the boundaries between columns of ranks according to the
+ * measured costs and migrates the columns changing owner. Collective over
+ * `mesh_comm->comm`.
+ *
+ * The local meshes are reallocated when the boundaries move: structures
+ * depending on the local width must then be rebuilt by the caller.
+ *
+ * @param balance Load balancer.
+ * @param mesh_comm Rank-level communicator, updated to the new area.
+ * @param mesh The mesh to compute.
+ * @param temp Temporary mesh used between collision and propagation.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param step Current step, for the report.
+ * @return Whether the boundaries moved.
+ **/
+bool lbm_balance_step(lbm_balance_t* balance, lbm_comm_t* mesh_comm,
+                      Mesh* mesh, Mesh* temp, lbm_mesh_type_t* mesh_type,
+                      uint32_t step);
+
+/**
+ * @brief Displays on the master the imbalance before balancing (first
+ * interval) and after it (steps since the last attempt, or last interval),
+ * along with the migration statistics. Collective over `mesh_comm->comm`.
+ *
+ * @param balance Load balancer.
+ * @param mesh_comm Rank-level communicator.
+ **/
+void lbm_balance_print(lbm_balance_t const* balance,
+                       lbm_comm_t const* mesh_comm);
+
+#endif // LBM_BALANCE_H
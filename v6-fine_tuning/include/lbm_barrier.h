@@ -0,0 +1,86 @@
+#ifndef LBM_BARRIER_H
+#define LBM_BARRIER_H
+
+#include <immintrin.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Number of busy-wait iterations before yielding the core.
+#define LBM_SPIN_BEFORE_YIELD 4096
+
+/**
+ * @brief Sense-reversing spin barrier.
+ *
+ * Unlike OpenMP barriers, it can be used by any subset of the threads of a
+ * team (e.g. only the workers while another thread is busy communicating).
+ **/
+typedef struct lbm_barrier_s {
+    /// Number of threads still expected in the current episode.
+    atomic_uint count;
+    /// Flipped by the last thread to arrive, releasing the others.
+    atomic_bool sense;
+    /// Number of threads taking part in the barrier.
+    uint32_t nb_threads;
+} lbm_barrier_t;
+
+/**
+ * @brief Busy-waits politely, yielding the core after a while so that
+ * oversubscribed runs still make progress.
+ *
+ * @param spins Number of iterations already spent waiting.
+ **/
+static inline void lbm_spin_pause(uint32_t* spins)
+{
+    if (++(*spins) < LBM_SPIN_BEFORE_YIELD) {
+        _mm_pause();
+    } else {
+        sched_yield();
+    }
+}
+
+static inline void lbm_barrier_init(lbm_barrier_t* barrier,
+                                    uint32_t nb_threads)
+{
+    atomic_init(&barrier->count, nb_threads);
+    atomic_init(&barrier->sense, false);
+    barrier->nb_threads = nb_threads;
+}
+
+/**
+ * @brief Waits until `nb_threads` threads reached the barrier.
+ **/
+static inline void lbm_barrier_wait(lbm_barrier_t* barrier)
+{
+    // The sense can only flip once every thread arrived, so it is safe to
+    // read it before decrementing
+    bool const sense =
+        !atomic_load_explicit(&barrier->sense, memory_order_relaxed);
+
+    if (atomic_fetch_sub_explicit(&barrier->count, 1, memory_order_acq_rel) ==
+        1) {
+        atomic_store_explicit(&barrier->count, barrier->nb_threads,
+                              memory_order_relaxed);
+        atomic_store_explicit(&barrier->sense, sense, memory_order_release);
+    } else {
+        uint32_t spins = 0;
+        while (atomic_load_explicit(&barrier->sense, memory_order_acquire) !=
+               sense) {
+            lbm_spin_pause(&spins);
+        }
+    }
+}
+
+/**
+ * @brief Busy-waits until `counter` reaches `target`.
+ **/
+static inline void lbm_spin_until(atomic_uint* counter, uint32_t target)
+{
+    uint32_t spins = 0;
+    while (atomic_load_explicit(counter, memory_order_acquire) < target) {
+        lbm_spin_pause(&spins);
+    }
+}
+
+#endif // LBM_BARRIER_H
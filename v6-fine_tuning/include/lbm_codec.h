@@ -0,0 +1,155 @@
+#ifndef LBM_CODEC_H
+#define LBM_CODEC_H
+
+#include "lbm_struct.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Number of byte planes of a frame: 4 bytes of each of the 2 quantities.
+#define LBM_CODEC_PLANES 8
+/// Precision of the symbol frequencies of the entropy coder.
+#define LBM_CODEC_SCALE_BITS 12
+/// Number of frames between two key frames, predicted from zeros instead of
+/// the previous frame so that decoding can start from them.
+#define LBM_CODEC_KEY_INTERVAL 32
+
+/**
+ * @brief Header of a frame in a compressed output file
+ * (`RESULT_MAGICK_COMPRESSED` or `RESULT_MAGICK_LOSSY`), followed by `size`
+ * bytes of payload.
+ **/
+typedef struct lbm_codec_record_s {
+    /// Size of the payload of the frame.
+    uint64_t size;
+} lbm_codec_record_t;
+
+/**
+ * @brief State of the lossless frame codec, shared by the encoder of the
+ * simulation and the decoder of `display`.
+ *
+ * The bits of each quantity are predicted from the cell above and from the
+ * previous frame (zeros for key frames): the prediction is the value of
+ * the previous frame plus how much the current frame changed from the cell
+ * above. The integer residuals of the predictions are small, so that their
+ * high bytes are mostly zeros. The bytes are then shuffled into one plane per
+ * byte of each quantity, and each plane is compressed with an order-0 rANS
+ * entropy coder, or stored raw if it does not shrink.
+ *
+ * Lossy frames first round each quantity to the nearest multiple of twice
+ * the error bound and encode these integers the same way. A quantity whose
+ * reconstruction would miss the bound (past the precision of a float, or out
+ * of range) is stored exactly after the planes.
+ **/
+typedef struct lbm_codec_s {
+    /// Number of cells of a frame.
+    size_t nb_cells;
+    /// Number of cells of a column of a frame.
+    size_t height;
+    /// Number of frames encoded or decoded, key frames included.
+    uint32_t nb_frames;
+    /// Absolute error bound of the last lossy frame.
+    double error_bound;
+    /// Largest error of the quantities of the last lossy frame.
+    double max_error;
+    /// Previous frame, as raw bits (or quantized values if lossy).
+    uint32_t* previous;
+    /// Quantized values of the current lossy frame.
+    uint32_t* words;
+    /// Byte planes of the current frame.
+    uint8_t* planes;
+    /// Encoded frame.
+    uint8_t* payload;
+    /// Number of bytes `payload` can hold.
+    size_t capacity;
+    /// Scratch buffer of the entropy coder.
+    uint8_t* scratch;
+} lbm_codec_t;
+
+/**
+ * @brief Allocates a codec for frames of `width` columns of `height` cells.
+ *
+ * @param codec Codec to initialize.
+ * @param width Width of the frames.
+ * @param height Height of the frames.
+ **/
+void lbm_codec_init(lbm_codec_t* codec, size_t width, size_t height);
+
+/**
+ * @brief Frees the memory of a codec.
+ *
+ * @param codec Codec to release.
+ **/
+void lbm_codec_release(lbm_codec_t* codec);
+
+/**
+ * @brief Starts decoding from a key frame.
+ *
+ * @param codec Codec to reset.
+ * @param frame Key frame decoded next, a multiple of `LBM_CODEC_KEY_INTERVAL`.
+ **/
+void lbm_codec_seek(lbm_codec_t* codec, uint32_t frame);
+
+/**
+ * @brief Computes the checksum of the entries of an area of a frame.
+ *
+ * Each 32-bit word is hashed with its position in the frame and the hashes
+ * are summed, so that the checksums of disjoint areas add up to the one of
+ * their union, whatever the order.
+ *
+ * @param entries Entries of the area, in column-major order.
+ * @param area X, Y, width and height of the area in the frame.
+ * @param height Height of the frame.
+ * @return Checksum of the area.
+ **/
+uint64_t lbm_codec_checksum(lbm_file_entry_t const* entries,
+                            uint32_t const area[4], uint32_t height);
+
+/**
+ * @brief Encodes the next frame into `codec->payload`.
+ *
+ * @param codec Codec holding the previous frame.
+ * @param frame Frame to encode.
+ * @return Size of the payload.
+ **/
+size_t lbm_codec_encode(lbm_codec_t* codec, lbm_file_entry_t const* frame);
+
+/**
+ * @brief Decodes the next frame.
+ *
+ * @param codec Codec holding the previous frame.
+ * @param payload Payload of the frame.
+ * @param size Size of the payload.
+ * @param frame Decoded frame.
+ * @return Whether the payload is well-formed.
+ **/
+bool lbm_codec_decode(lbm_codec_t* codec, uint8_t const* payload, size_t size,
+                      lbm_file_entry_t* frame);
+
+/**
+ * @brief Encodes the next frame into `codec->payload`, each quantity being
+ * off by at most `error_bound`.
+ *
+ * @param codec Codec holding the previous frame.
+ * @param frame Frame to encode, replaced by its decoded quantities.
+ * @param error_bound Absolute error bound of the quantities.
+ * @return Size of the payload.
+ **/
+size_t lbm_codec_encode_lossy(lbm_codec_t* codec, lbm_file_entry_t* frame,
+                              double error_bound);
+
+/**
+ * @brief Decodes the next lossy frame, and its errors into
+ * `codec->error_bound` and `codec->max_error`.
+ *
+ * @param codec Codec holding the previous frame.
+ * @param payload Payload of the frame.
+ * @param size Size of the payload.
+ * @param frame Decoded frame.
+ * @return Whether the payload is well-formed.
+ **/
+bool lbm_codec_decode_lossy(lbm_codec_t* codec, uint8_t const* payload,
+                            size_t size, lbm_file_entry_t* frame);
+
+#endif // LBM_CODEC_H
@@ -4,6 +4,8 @@
 #include "lbm_struct.h"
 
 #include <mpi.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 /// Definition of the master's process ID.
@@ -20,6 +22,141 @@ typedef enum lbm_corner_pos_e {
     CORNER_BOTTOM_RIGHT = 3,
 } lbm_corner_pos_t;
 
+/**
+ * @brief Sides of a local mesh, also used to name the direction in which
+ * populations travel.
+ **/
+typedef enum lbm_side_e {
+    SIDE_LEFT = 0,
+    SIDE_RIGHT = 1,
+    SIDE_TOP = 2,
+    SIDE_BOTTOM = 3,
+} lbm_side_t;
+
+/// Number of potential neighbours of a rank (sides and corners).
+#define NB_NEIGHBOURS 8
+
+/**
+ * @brief Implementations of the halo exchange.
+ **/
+typedef enum lbm_halo_backend_e {
+    /// Non-blocking point-to-point messages with each neighbour.
+    HALO_P2P,
+    /// A single neighbourhood collective over a distributed graph of the
+    /// neighbours.
+    HALO_NEIGHBOR,
+    /// Point-to-point messages set up once as persistent requests and only
+    /// started every step.
+    HALO_PERSISTENT,
+    /// Direct copies from the meshes of the neighbours on the same node,
+    /// allocated in a shared window, point-to-point messages with the others.
+    HALO_SHARED
+} lbm_halo_backend_t;
+
+/**
+ * @brief Precisions of the populations in the halo messages.
+ **/
+typedef enum lbm_halo_precision_e {
+    /// Populations sent as they are computed.
+    HALO_DOUBLE,
+    /// Difference to the equilibrium weight of the direction, as a float.
+    HALO_FLOAT,
+    /// Difference to the equilibrium weight of the direction, as a half.
+    HALO_HALF
+} lbm_halo_precision_t;
+
+/**
+ * @brief Placements of the ranks on the grid of subdomains.
+ **/
+typedef enum lbm_rank_placement_e {
+    /// Ranks numbered along X then Y, whatever their node.
+    PLACEMENT_LINEAR,
+    /// Reordering left to the MPI implementation (`MPI_Cart_create`).
+    PLACEMENT_CART,
+    /// Ranks of a node given a compact tile of the grid.
+    PLACEMENT_NODE
+} lbm_rank_placement_t;
+
+/**
+ * @brief Arguments of a neighbourhood `alltoallw`, which must stay valid
+ * until a non-blocking one completes. Displacements are relative to the
+ * cells of the exchanged mesh.
+ **/
+typedef struct lbm_comm_alltoallw_s {
+    int counts[NB_NEIGHBOURS];
+    MPI_Aint send_displs[NB_NEIGHBOURS];
+    MPI_Datatype send_types[NB_NEIGHBOURS];
+    MPI_Aint recv_displs[NB_NEIGHBOURS];
+    MPI_Datatype recv_types[NB_NEIGHBOURS];
+} lbm_comm_alltoallw_t;
+
+/**
+ * @brief Persistent requests of the point-to-point exchange, bound to the
+ * cells of one mesh. The first `nb_start` requests (receives and columns) are
+ * started by `lbm_comm_sync_ghosts_start`, the others (rows and corners) by
+ * `lbm_comm_sync_ghosts_wait`.
+ **/
+typedef struct lbm_comm_persistent_s {
+    /// Cells the requests are bound to, `NULL` when not set up.
+    double* cells;
+    MPI_Request requests[32];
+    int nb_requests;
+    int nb_start;
+    /// Messages and bytes sent by each of the two phases.
+    uint64_t messages_sent[2];
+    uint64_t bytes_sent[2];
+} lbm_comm_persistent_t;
+
+/**
+ * @brief Staging area of the reduced-precision halo messages of one exchange.
+ * Received messages are widened into the mesh once they all completed.
+ **/
+typedef struct lbm_comm_packed_s {
+    /// Messages of the current exchange, allocated one after the other.
+    char* buffer;
+    size_t capacity;
+    size_t used;
+    /// Pending receives: first ghost cell, direction of travel (message tag)
+    /// and message.
+    double* recv_cells[NB_NEIGHBOURS];
+    int recv_tags[NB_NEIGHBOURS];
+    char* recv_data[NB_NEIGHBOURS];
+    int nb_recvs;
+} lbm_comm_packed_t;
+
+/**
+ * @brief Synchronisation counters of a rank, at the beginning of its segment
+ * of the shared window. Each one sits on its own cache line.
+ **/
+typedef struct lbm_comm_flags_s {
+    /// Number of exchanges for which the boundary cells were collided.
+    _Alignas(64) atomic_uint published;
+    /// Number of exchanges for which the ghost cells were read from the
+    /// neighbours.
+    _Alignas(64) atomic_uint consumed;
+} lbm_comm_flags_t;
+
+/**
+ * @brief Neighbour on the same node, whose boundary cells are read directly
+ * from the shared window.
+ **/
+typedef struct lbm_comm_peer_s {
+    /// Rank of the neighbour.
+    int rank;
+    /// Synchronisation counters of the neighbour.
+    lbm_comm_flags_t* flags;
+    /// First cell read in the mesh of the neighbour.
+    double const* src;
+    /// First ghost cell written in the local mesh.
+    uint32_t dst_x;
+    uint32_t dst_y;
+    /// Number of cells copied, and distance in doubles between two of them
+    /// in the neighbour and local meshes.
+    uint32_t count;
+    uint32_t src_stride;
+    uint32_t dst_stride;
+} lbm_comm_peer_t;
+
 /**
  * @brief Type of communication.
  **/
@@ -39,8 +176,17 @@ typedef struct lbm_comm_t_s {
     /// Size of the local mesh.
     uint32_t width;
     uint32_t height;
+    /// Number of phantom layers on each side of the local mesh.
+    uint32_t ghost;
+    /// Number of ranks along each dimension.
     int nb_x;
     int nb_y;
+    /// Size of the global mesh (phantom meshes excluded).
+    uint32_t total_width;
+    uint32_t total_height;
+    /// First global column of each column of ranks (`nb_x + 1` entries, the
+    /// last one being `total_width`).
+    uint32_t* x_bounds;
     /// ID of the right neighboor, -1 if none.
     int right_id;
     /// ID of the left neighboor, -1 if none.
@@ -52,7 +198,59 @@ typedef struct lbm_comm_t_s {
     int corner_id[4];
     /// Async requests.
     MPI_Request requests[32];
-    lbm_mesh_cell_t buffer;
+    /// Number of pending requests in `requests`.
+    int nb_requests;
+    /// Inner cells of a column (left/right) or a row (top/bottom),
+    /// restricted to the populations travelling towards the given side (the
+    /// only ones the neighbour streams in).
+    MPI_Datatype side_types[4];
+    /// Corner cell, restricted to the populations travelling towards the
+    /// given corner.
+    MPI_Datatype corner_types[4];
+    /// Number of halo messages sent.
+    uint64_t messages_sent;
+    /// Number of halo bytes sent.
+    uint64_t bytes_sent;
+    /// Time spent waiting for the completion of the halo exchanges.
+    double wait_time;
+    /// Communicator of the compute ranks the grid was created from
+    /// (`MPI_COMM_WORLD` without I/O servers).
+    MPI_Comm world;
+    /// Cartesian communicator of the ranks, neighbour IDs refer to it.
+    MPI_Comm comm;
+    /// Implementation of the halo exchange.
+    lbm_halo_backend_t backend;
+    /// Distributed graph of the neighbours (`HALO_NEIGHBOR` only).
+    MPI_Comm graph_comm;
+    /// Arguments of the pending neighbourhood collective.
+    lbm_comm_alltoallw_t alltoallw;
+    /// Persistent requests (`HALO_PERSISTENT` only).
+    lbm_comm_persistent_t persistent;
+    /// Ranks sharing the memory of the node (`HALO_SHARED` only).
+    MPI_Comm node_comm;
+    /// Window holding the exchanged mesh (`HALO_SHARED` only).
+    MPI_Win window;
+    /// Synchronisation counters of the local rank, in the window.
+    lbm_comm_flags_t* flags;
+    /// Neighbours on the same node.
+    lbm_comm_peer_t peers[NB_NEIGHBOURS];
+    int nb_peers;
+    /// Number of completed exchanges.
+    uint32_t nb_exchanges;
+    /// Number of halo bytes copied from the neighbours on the same node.
+    uint64_t bytes_copied;
+    /// Precision of the halo messages (`HALO_P2P` only).
+    lbm_halo_precision_t precision;
+    /// Staging area of the reduced-precision messages.
+    lbm_comm_packed_t packed;
+    /// Placement of the ranks on the grid.
+    lbm_rank_placement_t placement;
+    /// Number of nodes running the ranks.
+    int nb_nodes;
+    /// Halo bytes sent to neighbours on the same node and on other nodes in
+    /// one exchange, with the chosen placement and with the linear one.
+    uint64_t node_bytes[2];
+    uint64_t linear_node_bytes[2];
 } lbm_comm_t;
 
 static inline int lbm_comm_width(lbm_comm_t const* mc)
@@ -65,20 +263,115 @@ static inline int lbm_comm_height(lbm_comm_t const* mc)
     return mc->height;
 }
 
+/**
+ * @brief First cell of a block in a near-equal split of `size` cells in
+ * `count` blocks (`index` may be `count` to get the end of the last one).
+ **/
+static inline uint32_t lbm_comm_split(uint32_t size, int count, int index)
+{
+    return (uint64_t)index * size / count;
+}
+
+/**
+ * @brief Whether the ghost rows of the local mesh are exchanged, i.e. the rank
+ * has a neighbour above or below.
+ **/
+static inline bool lbm_comm_exchanges_rows(lbm_comm_t const* mc)
+{
+    return mc->top_id != -1 || mc->bottom_id != -1;
+}
+
+/**
+ * @brief Whether the halos are exchanged at a given step. With deep halos,
+ * they are only exchanged once every `ghost` steps.
+ **/
+static inline bool lbm_comm_exchanges_at(lbm_comm_t const* mc, uint32_t step)
+{
+    return (step - 1) % mc->ghost == 0;
+}
+
+/**
+ * @brief Cells to collide at a given step: the local area, extended towards
+ * the neighbours by the ghost layers still valid since the last exchange
+ * (`ghost - 1` layers right after it, one less at each following step).
+ *
+ * @param mc Mesh communicator to use.
+ * @param step Current step.
+ * @param region Filled with the cells to collide.
+ **/
+static inline void lbm_comm_compute_region(lbm_comm_t const* mc,
+                                           uint32_t step, lbm_region_t* region)
+{
+    uint32_t const since = (step - 1) % mc->ghost;
+    uint32_t const extra = (since == 0) ? 0 : mc->ghost - since;
+
+    region->x_begin = mc->ghost - ((mc->left_id != -1) ? extra : 0);
+    region->x_end = mc->width - mc->ghost + ((mc->right_id != -1) ? extra : 0);
+    region->y_begin = mc->ghost - ((mc->top_id != -1) ? extra : 0);
+    region->y_end = mc->height - mc->ghost + ((mc->bottom_id != -1) ? extra : 0);
+}
+
 /**
  * @brief Initialize a `lbm_comm`:
  * - neighboors;
  * - size of the local mesh;
  * - relative position.
  *
+ * The ranks may be reordered according to `rank_placement`: the rank in
+ * `mesh_comm->comm` must then be used instead of the one in `world`.
+ *
  * @param mesh_comm Mesh communicator to initialize.
- * @param rank Rank asking the initialization.
+ * @param world Communicator of the compute ranks, kept by `mesh_comm`.
+ * @param rank Rank asking the initialization, in `world`.
  * @param comm_size Size of the communicator.
  * @param width Width of the mesh.
  * @param height Height of the mesh.
  **/
-void lbm_comm_init(lbm_comm_t* mesh_comm, int rank, int comm_size,
-                   uint32_t width, uint32_t height);
+void lbm_comm_init(lbm_comm_t* mesh_comm, MPI_Comm world, int rank,
+                   int comm_size, uint32_t width, uint32_t height);
+
+/**
+ * @brief Computes the area of the global mesh owned by a rank. Subdomains
+ * initially have near-equal sizes, which differ by at most one cell along
+ * each dimension, columns of ranks may then be resized by the load balancer.
+ *
+ * @param mesh_comm Initialized mesh communicator.
+ * @param rank Rank in `mesh_comm->comm`.
+ * @param x X position of the local mesh of the rank.
+ * @param y Y position of the local mesh of the rank.
+ * @param width Width of the local mesh (phantom meshes included).
+ * @param height Height of the local mesh (phantom meshes included).
+ **/
+void lbm_comm_rank_area(lbm_comm_t const* mesh_comm, int rank, uint32_t* x,
+                        uint32_t* y, uint32_t* width, uint32_t* height);
+
+/**
+ * @brief Updates the position and size of the local mesh, and the datatypes
+ * depending on them, after `x_bounds` was modified.
+ *
+ * @param mesh_comm Mesh communicator to update.
+ **/
+void lbm_comm_update_area(lbm_comm_t* mesh_comm);
+
+/**
+ * @brief Allocates the mesh exchanged by the halo exchange. With the shared
+ * backend, its cells are allocated in a window shared by the ranks of the
+ * node, and the neighbours on the same node are bound to it. Collective over
+ * `mesh_comm->comm`.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh Mesh to initialize.
+ **/
+void lbm_comm_mesh_init(lbm_comm_t* mesh_comm, Mesh* mesh);
+
+/**
+ * @brief Frees a mesh allocated by `lbm_comm_mesh_init`. Collective over
+ * `mesh_comm->comm`.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh Mesh to release.
+ **/
+void lbm_comm_mesh_release(lbm_comm_t* mesh_comm, Mesh* mesh);
 
 /**
  * @brief Releases the memory used by a `lib_comm_t`.
@@ -87,6 +380,25 @@ void lbm_comm_init(lbm_comm_t* mesh_comm, int rank, int comm_size,
  **/
 void lbm_comm_release(lbm_comm_t* mesh);
 
+/**
+ * @brief Lists the directions of the populations crossing a side of a mesh.
+ *
+ * @param dx X component of the side's outward normal (-1, 0 or 1).
+ * @param dy Y component of the side's outward normal (-1, 0 or 1). Both
+ * components set denote a corner.
+ * @param directions Filled with the crossing directions.
+ * @return Number of crossing directions.
+ **/
+int lbm_comm_crossing_directions(int dx, int dy, int directions[DIRECTIONS]);
+
+/**
+ * @brief Displays the halo exchange statistics of a rank.
+ *
+ * @param mesh_comm Communicator to report.
+ * @param rank Rank owning the communicator.
+ **/
+void lbm_comm_print_stats(lbm_comm_t const* mesh_comm, int rank);
+
 /**
  * @brief Displays the configuration of the `lbm_comm` for a given rank.
  *
@@ -94,10 +406,48 @@ void lbm_comm_release(lbm_comm_t* mesh);
  **/
 void lbm_comm_print(lbm_comm_t const* mesh_comm);
 
-void lbm_comm_sync_ghosts_wait(lbm_comm_t* mesh);
+/**
+ * @brief Starts the exchange of the ghost cells of a mesh: posts the
+ * non-blocking receives of every ghost cell and the sends of the boundary
+ * columns, which must already be computed.
+ *
+ * @param mesh Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+void lbm_comm_sync_ghosts_start(lbm_comm_t* mesh, Mesh* mesh_to_process);
 
-void lbm_comm_ghost_exchange(lbm_comm_t* mesh, Mesh* mesh_to_process);
+/**
+ * @brief Completes the exchange started by `lbm_comm_sync_ghosts_start`.
+ *
+ * The boundary rows and corners are sent here as they span every column:
+ * the whole mesh must be computed.
+ *
+ * @param mesh Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+void lbm_comm_sync_ghosts_wait(lbm_comm_t* mesh, Mesh* mesh_to_process);
 
-void save_frame_all_domain(FILE* fp, Mesh* source_mesh, Mesh* temp);
+/**
+ * @brief Posts one non-blocking message of the ghost columns exchanged with
+ * a side neighbour, completed with the other requests of the communicator.
+ *
+ * @param mesh Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ * @param comm_type Whether to send or receive.
+ * @param target_rank Rank to communicate with, -1 for none.
+ * @param x X coordinate of the first column.
+ * @param side Side towards which the exchanged populations travel.
+ **/
+void lbm_comm_sync_ghosts_horizontal(lbm_comm_t* mesh, Mesh* mesh_to_process,
+                                     lbm_comm_type_t comm_type, int target_rank,
+                                     uint32_t x, lbm_side_t side);
+
+/**
+ * @brief Exchanges the ghost cells of a mesh (blocking).
+ *
+ * @param mesh Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+void lbm_comm_ghost_exchange(lbm_comm_t* mesh, Mesh* mesh_to_process);
 
 #endif
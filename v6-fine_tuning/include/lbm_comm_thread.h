@@ -0,0 +1,111 @@
+#ifndef LBM_COMM_THREAD_H
+#define LBM_COMM_THREAD_H
+
+#include "lbm_barrier.h"
+#include "lbm_comm.h"
+#include "lbm_output.h"
+#include "lbm_struct.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+/// OpenMP thread ID reserved for communications.
+#define COMM_THREAD_ID 0
+
+/**
+ * @brief State of a time loop where one thread per rank is dedicated to
+ * communications.
+ *
+ * The communication thread drives the ghost exchange (and frame gathering)
+ * while the other threads, the workers, compute the inner columns. The
+ * boundary columns are computed first so that the exchange can start as
+ * soon as possible.
+ **/
+typedef struct lbm_comm_thread_s {
+    /// Barrier between the workers only.
+    lbm_barrier_t workers;
+    /// Number of workers.
+    uint32_t nb_workers;
+    /// Number of boundary columns collided in the current step.
+    atomic_uint edges_done;
+    /// Number of workers done colliding their columns in the current step.
+    atomic_uint collide_done;
+    /// Number of workers done copying their columns in the snapshot.
+    atomic_uint snapshot_done;
+    /// Set once the ghost cells have been received.
+    atomic_uint ghosts_done;
+    /// Whether a frame must be saved from the snapshot in the current step.
+    bool frame_pending;
+    /// Copy of the mesh used to save a frame while computing the next step.
+    Mesh snapshot;
+    /// Time the workers spent waiting on each side for the ghost cells.
+    double wait_left;
+    double wait_right;
+    /// Accumulated time spent communicating by the communication thread.
+    double comm_time;
+    /// Accumulated communication time that could not be hidden.
+    double exposed_time;
+} lbm_comm_thread_t;
+
+/**
+ * @brief Initializes the state of the communication thread.
+ *
+ * @param comm_thread State to initialize.
+ * @param nb_threads Number of threads in the team (communication thread
+ * included, must be at least 2).
+ * @param mesh_comm Rank-level communicator (for the size of the snapshot).
+ **/
+void lbm_comm_thread_init(lbm_comm_thread_t* comm_thread, int nb_threads,
+                          lbm_comm_t const* mesh_comm);
+
+/**
+ * @brief Frees the memory used by the state of the communication thread.
+ *
+ * @param comm_thread State to release.
+ **/
+void lbm_comm_thread_release(lbm_comm_thread_t* comm_thread);
+
+/**
+ * @brief Runs one time step. Must be called by every thread of the team.
+ *
+ * @param comm_thread State of the communication thread.
+ * @param mesh The mesh to compute.
+ * @param temp Temporary mesh used between collision and propagation.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm Rank-level communicator.
+ * @param output Output to write pending frames to.
+ **/
+void lbm_comm_thread_step(lbm_comm_thread_t* comm_thread, Mesh* mesh,
+                          Mesh* temp, lbm_mesh_type_t* mesh_type,
+                          lbm_comm_t* mesh_comm, lbm_output_t* output);
+
+/**
+ * @brief Requests a frame to be saved. The mesh is copied at the beginning of
+ * the next step and saved while the workers compute.
+ *
+ * @param comm_thread State of the communication thread.
+ **/
+void lbm_comm_thread_request_frame(lbm_comm_thread_t* comm_thread);
+
+/**
+ * @brief Saves the pending frame, if any, without overlapping it (e.g. after
+ * the last step).
+ *
+ * @param comm_thread State of the communication thread.
+ * @param mesh_comm Rank-level communicator.
+ * @param mesh The mesh to save.
+ * @param output Output to write to.
+ **/
+void lbm_comm_thread_flush_frame(lbm_comm_thread_t* comm_thread,
+                                 lbm_comm_t const* mesh_comm, Mesh* mesh,
+                                 lbm_output_t* output);
+
+/**
+ * @brief Percentage of the communication time hidden behind computation.
+ *
+ * @param comm_thread State of the communication thread.
+ * @return Overlap percentage.
+ **/
+double lbm_comm_thread_overlap(lbm_comm_thread_t const* comm_thread);
+
+#endif // LBM_COMM_THREAD_H
@@ -36,6 +36,9 @@
 // Result filename
 #define RESULT_FILENAME (lbm_gbl_config.output_filename)
 #define RESULT_MAGICK 0x12345
+#define RESULT_MAGICK_COMPRESSED 0x12346
+#define RESULT_MAGICK_LOSSY 0x12347
+#define RESULT_MAGICK_INDEX 0x12348
 #define WRITE_BUFFER_ENTRIES 4096
 #define WRITE_STEP_INTERVAL (lbm_gbl_config.write_interval)
 
@@ -67,6 +70,42 @@ typedef struct lbm_config_s {
     const char* output_filename;
     /// Interval between writes to file.
     uint32_t write_interval;
+    /// Give each OpenMP thread its own subdomain (with ghost cells) instead
+    /// of sharing the rank's mesh.
+    uint32_t thread_domains;
+    /// Split the rank's domain in this many blocks with their own ghost
+    /// cells, scheduled independently, 0 to disable.
+    uint32_t blocks_per_rank;
+    /// Dedicate one thread per rank to the ghost exchange and frame gathering
+    /// while the other threads compute.
+    uint32_t comm_thread;
+    /// Scheduling policy of the columns between threads (`lbm_sched_policy_t`).
+    uint32_t scheduler;
+    /// Number of columns per chunk for the instrumented schedulers.
+    uint32_t sched_chunk;
+    /// Number of steps between two load balancing attempts, 0 to disable.
+    uint32_t balance_interval;
+    /// Implementation of the halo exchange (`lbm_halo_backend_t`).
+    uint32_t halo_backend;
+    /// Number of ghost layers, exchanged once every `halo_depth` steps.
+    uint32_t halo_depth;
+    /// Precision of the halo messages (`lbm_halo_precision_t`).
+    uint32_t halo_precision;
+    /// Implementation of the frame output (`lbm_output_backend_t`).
+    uint32_t output_backend;
+    /// Number of snapshot buffers of the writer thread (or of frames in flight
+    /// to the I/O servers), 0 to write frames synchronously.
+    uint32_t output_buffers;
+    /// Number of ranks reserved to write the frames, 0 to write them from the
+    /// compute ranks.
+    uint32_t io_servers;
+    /// Compression of the frames (`lbm_output_compression_t`).
+    uint32_t output_compression;
+    /// Absolute error bound of the quantities of lossy frames.
+    double output_error_bound;
+    /// Placement of the ranks on the grid of subdomains
+    /// (`lbm_rank_placement_t`).
+    uint32_t rank_placement;
 } lbm_config_t;
 
 /// Configuration accessible as a global variable.
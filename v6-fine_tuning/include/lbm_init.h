@@ -64,6 +64,10 @@ void setup_init_state_border(Mesh* mesh, lbm_mesh_type_t* mesh_type,
 
 /**
  * @brief Sets up the initial conditions.
+ *
+ * Loops are parallelized over the columns with the same static distribution
+ * as the time loop, so memory pages are first touched by the thread using
+ * them. Nested in a parallel region, they run on the calling thread only.
  * 
  * @param mesh The mesh to initialize.
  * @param mesh_type The information grid denotating the type of mesh.
@@ -73,4 +77,13 @@ void setup_init_state_border(Mesh* mesh, lbm_mesh_type_t* mesh_type,
 void setup_init_state(Mesh* mesh, lbm_mesh_type_t* mesh_type,
                       lbm_comm_t const* mesh_comm);
 
+/**
+ * @brief Copies the initial conditions of a mesh into another one of the same
+ * size (e.g. from `mesh` to `temp`) instead of computing them twice.
+ *
+ * @param mesh_out The mesh to initialize.
+ * @param mesh_in The already initialized mesh.
+ **/
+void setup_init_state_copy(Mesh* mesh_out, Mesh const* mesh_in);
+
 #endif // LBM_INIT_H
@@ -0,0 +1,185 @@
+#ifndef LBM_OUTPUT_H
+#define LBM_OUTPUT_H
+
+#include "lbm_codec.h"
+#include "lbm_comm.h"
+#include "lbm_struct.h"
+
+#include <mpi.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Implementations of the frame output.
+ **/
+typedef enum lbm_output_backend_e {
+    /// Frames gathered on the master, which writes them with `fwrite`.
+    OUTPUT_POSIX,
+    /// Every rank writes its part of the frames with collective MPI-IO.
+    OUTPUT_MPIIO,
+    /// Frames gathered on one aggregator per node, which writes the cells of
+    /// the node with one independent MPI-IO call.
+    OUTPUT_NODE,
+    /// Frames sent to dedicated I/O server ranks, which assemble bands of
+    /// columns and write them with MPI-IO (chosen by `io_servers`).
+    OUTPUT_SERVERS
+} lbm_output_backend_t;
+
+/**
+ * @brief Compression of the frames in the output file.
+ **/
+typedef enum lbm_output_compression_e {
+    /// Raw frame entries (`RESULT_MAGICK`).
+    COMPRESSION_NONE,
+    /// Frames encoded by `lbm_codec_encode` (`RESULT_MAGICK_COMPRESSED`).
+    COMPRESSION_LOSSLESS,
+    /// Frames encoded by `lbm_codec_encode_lossy` within
+    /// `output_error_bound` (`RESULT_MAGICK_LOSSY`).
+    COMPRESSION_LOSSY
+} lbm_output_compression_t;
+
+/**
+ * @brief Snapshot of the cells of a rank, waiting to be written.
+ **/
+typedef struct lbm_output_buffer_s {
+    /// Frame entries of the cells of the rank, in column-major order.
+    lbm_file_entry_t* entries;
+    /// Number of entries `entries` can hold.
+    size_t capacity;
+    /// X, Y, width and height of the cells of the rank in the global mesh.
+    uint32_t area[4];
+    /// Areas of all ranks at the time of the snapshot (master of
+    /// `OUTPUT_POSIX` only).
+    uint32_t* areas;
+    /// Sends of the area and of the entries to the I/O server
+    /// (`OUTPUT_SERVERS` only).
+    MPI_Request requests[2];
+} lbm_output_buffer_t;
+
+/**
+ * @brief Output file of the simulation: a `lbm_file_header_t` followed by
+ * the frames of the whole domain, in the global column-major order, then by
+ * the index of the frames and a `lbm_file_footer_t`.
+ **/
+typedef struct lbm_output_s {
+    /// Implementation of the output.
+    lbm_output_backend_t backend;
+    /// Output file of the master (`OUTPUT_POSIX` only).
+    FILE* fp;
+    /// Output file shared by the ranks (`OUTPUT_MPIIO` only).
+    MPI_File file;
+    /// One frame entry, the element of the file views.
+    MPI_Datatype entry_type;
+    /// Communicator of the output, duplicated from the rank-level one so that
+    /// frames may be written while halos are exchanged, or intercommunicator
+    /// with the I/O servers.
+    MPI_Comm comm;
+    /// I/O server of the rank (`OUTPUT_SERVERS` only).
+    int server;
+    /// Ranks of the node of the rank (`OUTPUT_NODE` only).
+    MPI_Comm node_comm;
+    /// Aggregators of the nodes, the first rank of each node (`OUTPUT_NODE`
+    /// only, `MPI_COMM_NULL` on the other ranks).
+    MPI_Comm aggregators;
+    /// Areas of the ranks of the node (aggregators of `OUTPUT_NODE` only).
+    uint32_t* node_areas;
+    /// Frame entries of the ranks of the node, packed rank after rank
+    /// (aggregators of `OUTPUT_NODE` only).
+    lbm_file_entry_t* node_entries;
+    /// Number of entries `node_entries` can hold.
+    size_t node_capacity;
+    /// Number of ranks writing to the file.
+    int nb_writers;
+    /// Encoder of the frames (master of `OUTPUT_POSIX` with compression
+    /// only).
+    lbm_codec_t* codec;
+    /// Size of the frames written by the rank, before compression.
+    uint64_t raw_bytes;
+    /// Size of the frames in the file, as written by the rank.
+    uint64_t stored_bytes;
+    /// Largest error of the quantities of the lossy frames written by the
+    /// rank.
+    double max_error;
+    /// Number of frames written.
+    uint32_t nb_frames;
+    /// Index of the frames written, with the checksums of the cells written
+    /// by the rank (master of `OUTPUT_POSIX`, and every rank of
+    /// `OUTPUT_MPIIO` and `OUTPUT_NODE` only).
+    lbm_file_index_entry_t* index;
+    /// Number of entries `index` can hold.
+    uint32_t index_capacity;
+    /// Time the solver spent in `lbm_output_write_frame`.
+    double time;
+    /// Time the solver was blocked by the output, waiting for a free buffer or
+    /// writing itself.
+    double stall_time;
+    /// Time spent writing frames, by the solver, the writer thread or the
+    /// slowest I/O server.
+    double write_time;
+    /// Number of snapshot buffers, 0 if frames are written synchronously.
+    /// With `OUTPUT_SERVERS`, number of frames in flight to the I/O server.
+    uint32_t nb_buffers;
+    /// Ring of snapshot buffers.
+    lbm_output_buffer_t* buffers;
+    /// Oldest snapshot waiting to be written.
+    uint32_t head;
+    /// Number of snapshots waiting to be written.
+    uint32_t nb_ready;
+    /// Set when no more snapshot will be taken.
+    bool done;
+    /// Whole frame assembled by the master (`OUTPUT_POSIX` with the writer
+    /// thread or compression only).
+    lbm_file_entry_t* frame;
+    /// Writer thread draining the snapshots.
+    pthread_t writer;
+    /// Protects `head`, `nb_ready` and `done`.
+    pthread_mutex_t lock;
+    /// Signaled when a snapshot is ready or the output is closed.
+    pthread_cond_t ready;
+    /// Signaled when a buffer is free again.
+    pthread_cond_t free;
+} lbm_output_t;
+
+/**
+ * @brief Main function of the I/O server ranks: receives the frames of a band
+ * of columns of ranks and writes them, until the compute ranks close their
+ * output. Collective over `servers` and the compute ranks.
+ *
+ * @param servers Communicator of the I/O servers.
+ **/
+void lbm_output_serve(MPI_Comm servers);
+
+/**
+ * @brief Creates the output file and writes its header. Collective over
+ * `mesh_comm->comm`, and the I/O servers if any.
+ *
+ * @param output Output to open.
+ * @param mesh_comm Rank-level communicator.
+ **/
+void lbm_output_open(lbm_output_t* output, lbm_comm_t const* mesh_comm);
+
+/**
+ * @brief Writes one frame of the whole domain. Collective over
+ * `mesh_comm->comm`. With snapshot buffers, only copies the frame entries of
+ * the rank into a free buffer, waiting for one if the writer thread is
+ * behind, and returns while the writer thread writes them.
+ *
+ * @param output Output to write to.
+ * @param mesh_comm Rank-level communicator.
+ * @param mesh Local mesh to save.
+ **/
+void lbm_output_write_frame(lbm_output_t* output, lbm_comm_t const* mesh_comm,
+                            Mesh const* mesh);
+
+/**
+ * @brief Waits for the pending snapshots to be written, appends the index of
+ * the frames and closes the output file. Collective over `mesh_comm->comm`,
+ * and the I/O servers if any.
+ *
+ * @param output Output to close.
+ **/
+void lbm_output_close(lbm_output_t* output);
+
+#endif // LBM_OUTPUT_H
@@ -5,6 +5,8 @@
 #include "lbm_struct.h"
 
 extern double const equil_weight[DIRECTIONS];
+extern double const direction_a[DIRECTIONS];
+extern double const direction_b[DIRECTIONS];
 
 /** ------------------------------------------------------------------------ **
  * Helper functions                                                           *
@@ -114,6 +116,68 @@ void compute_outflow_zou_he_const_density(lbm_mesh_cell_t mesh);
  * Main functions                                                             *
  ** ------------------------------------------------------------------------ **/
 
+/**
+ * @brief Applies the special actions to the inner cells of a single column.
+ *
+ * Serial building block of `special_cells`, for callers that distribute the
+ * columns themselves.
+ *
+ * @param mesh The mesh to apply the special actions to.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm The communication structure to determine the absolute
+ * position in the global mesh.
+ * @param i X coordinate of the column.
+ **/
+void special_cells_column(Mesh* mesh, lbm_mesh_type_t* mesh_type,
+                          lbm_comm_t const* mesh_comm, size_t i);
+
+/**
+ * @brief Applies the special actions to the rows `[j_begin, j_end)` of a
+ * single column.
+ *
+ * @param mesh The mesh to apply the special actions to.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm The communication structure to determine the absolute
+ * position in the global mesh.
+ * @param i X coordinate of the column.
+ * @param j_begin First row.
+ * @param j_end Row after the last one.
+ **/
+void special_cells_rows(Mesh* mesh, lbm_mesh_type_t* mesh_type,
+                        lbm_comm_t const* mesh_comm, size_t i, size_t j_begin,
+                        size_t j_end);
+
+/**
+ * @brief Computes the collisions on the inner cells of a single column.
+ *
+ * @param mesh_out Mesh before special actions.
+ * @param mesh_in after special actions.
+ * @param i X coordinate of the column.
+ **/
+void collision_column(Mesh* mesh_out, Mesh const* mesh_in, size_t i);
+
+/**
+ * @brief Computes the collisions on the rows `[j_begin, j_end)` of a single
+ * column.
+ *
+ * @param mesh_out Mesh before special actions.
+ * @param mesh_in after special actions.
+ * @param i X coordinate of the column.
+ * @param j_begin First row.
+ * @param j_end Row after the last one.
+ **/
+void collision_rows(Mesh* mesh_out, Mesh const* mesh_in, size_t i,
+                    size_t j_begin, size_t j_end);
+
+/**
+ * @brief Propagates the densities of a single column on the neighboor meshes.
+ *
+ * @param mesh_out Output mesh.
+ * @param mesh_in Input mesh (cannot be the same).
+ * @param i X coordinate of the source column.
+ **/
+void propagation_column(Mesh* mesh_out, Mesh const* mesh_in, size_t i);
+
 /**
  * @brief Applies the special actions linked to the conditions at the borders
  * or at the obstacle reflexions.
@@ -142,4 +206,66 @@ void collision(Mesh* mesh_out, Mesh const* mesh_in);
  **/
 void propagation(Mesh* mesh_out, Mesh const* mesh_in);
 
+/**
+ * @brief Applies the special actions and computes the collisions on the two
+ * boundary columns (the ones sent to the neighbours). Must be called by every
+ * thread of the team.
+ *
+ * @param mesh_out Mesh after collision.
+ * @param mesh_in Mesh before special actions.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm The communication structure to determine the absolute
+ * position in the global mesh.
+ **/
+void collision_boundaries(Mesh* mesh_out, Mesh* mesh_in,
+                          lbm_mesh_type_t* mesh_type,
+                          lbm_comm_t const* mesh_comm);
+
+/**
+ * @brief Applies the special actions and computes the collisions on the
+ * inner columns, boundary columns excluded.
+ *
+ * @param mesh_out Mesh after collision.
+ * @param mesh_in Mesh before special actions.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm The communication structure to determine the absolute
+ * position in the global mesh.
+ **/
+void collision_inner(Mesh* mesh_out, Mesh* mesh_in,
+                     lbm_mesh_type_t* mesh_type, lbm_comm_t const* mesh_comm);
+
+/**
+ * @brief Applies the special actions and computes the collisions on a region
+ * of the mesh, which may include ghost layers with deep halos. Must be called
+ * by every thread of the team.
+ *
+ * @param mesh_out Mesh after collision.
+ * @param mesh_in Mesh before special actions.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm The communication structure to determine the absolute
+ * position in the global mesh.
+ * @param region Cells to compute.
+ **/
+void collision_region(Mesh* mesh_out, Mesh* mesh_in,
+                      lbm_mesh_type_t* mesh_type, lbm_comm_t const* mesh_comm,
+                      lbm_region_t const* region);
+
+/**
+ * @brief Propagates the densities of the inner columns, which do not depend
+ * on the ghost cells. No barrier at the end.
+ *
+ * @param mesh_out Output mesh.
+ * @param mesh_in Input mesh (cannot be the same).
+ **/
+void propagation_inner(Mesh* mesh_out, Mesh const* mesh_in);
+
+/**
+ * @brief Propagates the densities of the two ghost columns, once received.
+ * Serial, to be called by a single thread.
+ *
+ * @param mesh_out Output mesh.
+ * @param mesh_in Input mesh (cannot be the same).
+ **/
+void propagation_ghosts(Mesh* mesh_out, Mesh const* mesh_in);
+
 #endif // LBM_PHYS_H
@@ -0,0 +1,69 @@
+#ifndef LBM_POOL_H
+#define LBM_POOL_H
+
+#include "lbm_barrier.h"
+#include "lbm_comm.h"
+#include "lbm_struct.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/**
+ * @brief Minimal persistent thread pool used instead of the OpenMP runtime in
+ * the time loop (build with `-DTHREAD_POOL`).
+ *
+ * Workers are created once, pinned to their own core and statically given
+ * the same columns at every step. The calling thread takes part in the work
+ * as thread 0, pinned as well while the pool lives, and all the
+ * synchronisations are sense-reversing spin barriers.
+ **/
+typedef struct lbm_pool_s {
+    /// Number of threads, calling thread included.
+    int nb_threads;
+    /// Worker threads (`nb_threads - 1`).
+    pthread_t* threads;
+    /// Barrier shared by all the threads of the pool.
+    lbm_barrier_t barrier;
+    /// Cleared to make the workers exit.
+    atomic_bool running;
+    /// Affinity of the calling thread before the pool pinned it.
+    cpu_set_t affinity;
+    /// Data of the current step.
+    Mesh* mesh;
+    Mesh* temp;
+    lbm_mesh_type_t* mesh_type;
+    lbm_comm_t* mesh_comm;
+} lbm_pool_t;
+
+/**
+ * @brief Starts the workers of a pool.
+ *
+ * @param pool Pool to initialize.
+ * @param comm Communicator of the ranks whose pools share the nodes.
+ * @param nb_threads Number of threads, calling thread included.
+ **/
+void lbm_pool_init(lbm_pool_t* pool, MPI_Comm comm, int nb_threads);
+
+/**
+ * @brief Stops the workers, restores the affinity of the calling thread and
+ * frees the memory of a pool.
+ *
+ * @param pool Pool to release.
+ **/
+void lbm_pool_release(lbm_pool_t* pool);
+
+/**
+ * @brief Runs one time step with all the threads of the pool.
+ *
+ * @param pool Pool to use.
+ * @param mesh The mesh to compute.
+ * @param temp Temporary mesh used between collision and propagation.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm Rank-level communicator.
+ **/
+void lbm_pool_step(lbm_pool_t* pool, Mesh* mesh, Mesh* temp,
+                   lbm_mesh_type_t* mesh_type, lbm_comm_t* mesh_comm);
+
+#endif // LBM_POOL_H
@@ -0,0 +1,110 @@
+#ifndef LBM_SCHED_H
+#define LBM_SCHED_H
+
+#include "lbm_comm.h"
+#include "lbm_struct.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/// Size of a cache line, to keep per-thread data apart.
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief Scheduling policies of the columns between the threads of a rank.
+ **/
+typedef enum lbm_sched_policy_e {
+    /// Plain `omp for schedule(static)` loops, no statistics.
+    SCHED_OMP,
+    /// Same static partition, instrumented with busy/idle statistics.
+    SCHED_STATIC,
+    /// Static partition as a starting point, idle threads steal chunks of
+    /// columns from the others.
+    SCHED_STEALING
+} lbm_sched_policy_t;
+
+/**
+ * @brief Lock-free work-stealing deque (Chase-Lev) of chunk IDs.
+ *
+ * The owner pushes and pops at the bottom, thieves steal at the top.
+ **/
+typedef struct lbm_deque_s {
+    atomic_long top;
+    atomic_long bottom;
+    /// Circular buffer of chunk IDs.
+    atomic_uint* chunks;
+    /// Capacity of the buffer (number of chunks of a phase).
+    long capacity;
+} __attribute__((aligned(CACHE_LINE_SIZE))) lbm_deque_t;
+
+/**
+ * @brief Per-thread statistics of the scheduler.
+ **/
+typedef struct lbm_thread_stats_s {
+    /// Time spent computing chunks.
+    double busy;
+    /// Time spent looking for work or waiting for the other threads.
+    double idle;
+    /// Number of chunks computed.
+    uint64_t chunks;
+    /// Number of chunks stolen from other threads.
+    uint64_t stolen;
+} __attribute__((aligned(CACHE_LINE_SIZE))) lbm_thread_stats_t;
+
+/**
+ * @brief Scheduler of the columns of the local mesh between the threads.
+ **/
+typedef struct lbm_sched_s {
+    /// Scheduling policy.
+    lbm_sched_policy_t policy;
+    /// Number of threads of the team.
+    int nb_threads;
+    /// Number of columns per chunk.
+    uint32_t chunk_size;
+    /// One deque per thread.
+    lbm_deque_t* deques;
+    /// One set of statistics per thread.
+    lbm_thread_stats_t* stats;
+} lbm_sched_t;
+
+/**
+ * @brief Initializes a scheduler.
+ *
+ * @param sched Scheduler to initialize.
+ * @param policy Scheduling policy.
+ * @param nb_threads Number of threads of the team.
+ * @param chunk_size Number of columns per chunk.
+ * @param width Width of the local mesh (phantom meshes included).
+ **/
+void lbm_sched_init(lbm_sched_t* sched, lbm_sched_policy_t policy,
+                    int nb_threads, uint32_t chunk_size, uint32_t width);
+
+/**
+ * @brief Frees the memory used by a scheduler.
+ *
+ * @param sched Scheduler to release.
+ **/
+void lbm_sched_release(lbm_sched_t* sched);
+
+/**
+ * @brief Runs one time step with the scheduler. Must be called by every
+ * thread of the team.
+ *
+ * @param sched Scheduler to use.
+ * @param mesh The mesh to compute.
+ * @param temp Temporary mesh used between collision and propagation.
+ * @param mesh_type The information grid denotating the type of mesh.
+ * @param mesh_comm Rank-level communicator.
+ **/
+void lbm_sched_step(lbm_sched_t* sched, Mesh* mesh, Mesh* temp,
+                    lbm_mesh_type_t* mesh_type, lbm_comm_t* mesh_comm);
+
+/**
+ * @brief Displays the per-thread busy and idle statistics of a rank.
+ *
+ * @param sched Scheduler to report.
+ * @param rank Rank owning the scheduler.
+ **/
+void lbm_sched_print_stats(lbm_sched_t const* sched, int rank);
+
+#endif // LBM_SCHED_H
@@ -26,6 +26,16 @@ typedef struct Mesh {
     uint32_t height;
 } Mesh;
 
+/**
+ * @brief Rectangle of cells of a local mesh, ends excluded.
+ **/
+typedef struct lbm_region_s {
+    uint32_t x_begin;
+    uint32_t x_end;
+    uint32_t y_begin;
+    uint32_t y_end;
+} lbm_region_t;
+
 /**
  * @brief Cell types definitions in order to know which process to apply when
  * computing.
@@ -77,6 +87,32 @@ typedef struct lbm_file_entry_s {
     float rho;
 } lbm_file_entry_t;
 
+/**
+ * @brief An entry of the frame index at the end of the output file.
+ **/
+typedef struct lbm_file_index_entry_s {
+    /// Offset of the frame in the file.
+    uint64_t offset;
+    /// Size of the frame in the file.
+    uint64_t size;
+    /// Checksum of the entries of the frame (`lbm_codec_checksum`).
+    uint64_t checksum;
+    /// Iteration of the frame.
+    uint32_t iteration;
+    /// First frame to read to decode this one (itself unless compressed).
+    uint32_t key;
+} lbm_file_index_entry_t;
+
+/**
+ * @brief Footer of the output file, right after the index of its frames.
+ **/
+typedef struct lbm_file_footer_s {
+    /// For validating the presence of the index.
+    uint32_t magick;
+    /// Number of entries of the index.
+    uint32_t nb_frames;
+} lbm_file_footer_t;
+
 /**
  * @brief Structure to read the output file.
  **/
@@ -84,6 +120,15 @@ typedef struct lbm_data_file_s {
     FILE* fp;
     lbm_file_header_t header;
     lbm_file_entry_t* entries;
+    /// Decoder of the frames, NULL if they are not compressed.
+    struct lbm_codec_s* codec;
+    /// Index of the frames, NULL if the file has none (e.g. interrupted
+    /// simulation).
+    lbm_file_index_entry_t* index;
+    /// Number of entries of the index.
+    uint32_t nb_frames;
+    /// Frame read by the next call to `read_next_frame`.
+    uint32_t next_frame;
 } lbm_data_file_t;
 
 /**
@@ -115,7 +160,8 @@ void lbm_mesh_type_t_init(lbm_mesh_type_t* mesh, uint32_t width,
  **/
 void lbm_mesh_type_t_release(lbm_mesh_type_t* mesh);
 
-void save_frame(FILE* fp, Mesh const* mesh);
+void fill_frame(lbm_file_entry_t* entries, size_t stride, Mesh const* mesh,
+                uint32_t ghost);
 
 /**
  * @brief Prints a fatal error message.
@@ -0,0 +1,112 @@
+#ifndef LBM_SUBDOMAIN_H
+#define LBM_SUBDOMAIN_H
+
+#include "lbm_comm.h"
+#include "lbm_struct.h"
+
+/**
+ * @brief Part of the local domain owned by a single thread.
+ *
+ * It mirrors the rank-level decomposition: the subdomain has its own meshes
+ * (with ghost cells) and its own `lbm_comm_t` describing its position in the
+ * global mesh and its neighbours. A neighbour living on the same rank is
+ * flagged by its thread ID, its ghost cells are then filled by reading
+ * directly in the neighbour's mesh instead of going through MPI.
+ *
+ * The same structure describes the blocks of an over-decomposed rank, which
+ * are more numerous than the threads and scheduled dynamically: the
+ * "thread" IDs are then block IDs.
+ **/
+typedef struct lbm_subdomain_s {
+    /// Position, size and MPI neighbours of the subdomain.
+    /// `left_id`/`right_id` are set to the current rank when the neighbour is
+    /// another thread of the same process.
+    lbm_comm_t comm;
+    /// ID of the left neighbouring subdomain on the same rank, -1 if none.
+    int left_tid;
+    /// ID of the right neighbouring subdomain on the same rank, -1 if none.
+    int right_tid;
+    /// Mesh of the subdomain (phantom meshes included).
+    Mesh mesh;
+    /// Temporary mesh used between collision and propagation.
+    Mesh temp;
+    /// Cell types of the subdomain.
+    lbm_mesh_type_t mesh_type;
+} lbm_subdomain_t;
+
+/**
+ * @brief Splits the local domain along X and describes the `id`-th part.
+ *
+ * @param subdomain Subdomain to describe.
+ * @param mesh_comm Rank-level communicator of the local domain.
+ * @param id ID of the subdomain (usually the thread ID).
+ * @param count Total number of subdomains on the rank.
+ **/
+void lbm_subdomain_split(lbm_subdomain_t* subdomain,
+                         lbm_comm_t const* mesh_comm, int id, int count);
+
+/**
+ * @brief Allocates the meshes of a subdomain and sets up the initial
+ * conditions.
+ *
+ * Must be called by the owning thread so memory pages are first touched on
+ * its NUMA node.
+ *
+ * @param subdomain Subdomain to initialize.
+ **/
+void lbm_subdomain_init(lbm_subdomain_t* subdomain);
+
+/**
+ * @brief Frees the memory of a subdomain.
+ *
+ * @param subdomain Subdomain to release.
+ **/
+void lbm_subdomain_release(lbm_subdomain_t* subdomain);
+
+/**
+ * @brief Fills the ghost columns of the `temp` mesh of a subdomain.
+ *
+ * Neighbours on the same rank are read directly from shared memory,
+ * neighbours on other ranks are exchanged through MPI.
+ * Neighbours must have finished their collision step before this is called.
+ *
+ * @param subdomains All the subdomains of the rank.
+ * @param id ID of the subdomain to update.
+ **/
+void lbm_subdomain_ghost_exchange(lbm_subdomain_t* subdomains, int id);
+
+/**
+ * @brief Runs one time step on a subdomain.
+ *
+ * Must be called by every thread of the team owning the subdomains.
+ *
+ * @param subdomains All the subdomains of the rank.
+ * @param id ID of the subdomain to compute.
+ **/
+void lbm_subdomain_step(lbm_subdomain_t* subdomains, int id);
+
+/**
+ * @brief Runs one time step on all the blocks of the rank.
+ *
+ * The blocks on the edges of the rank are collided first and post their
+ * halo messages right away, the inner blocks are collided while the messages
+ * travel. Must be called by every thread of the team, with
+ * `MPI_THREAD_MULTIPLE`.
+ *
+ * @param blocks All the blocks of the rank.
+ * @param count Number of blocks.
+ **/
+void lbm_subdomain_blocks_step(lbm_subdomain_t* blocks, int count);
+
+/**
+ * @brief Copies the inner columns of a subdomain back into the rank-level
+ * mesh (e.g. before saving a frame).
+ *
+ * @param mesh Rank-level mesh.
+ * @param mesh_comm Rank-level communicator of the local domain.
+ * @param subdomain Subdomain to copy.
+ **/
+void lbm_subdomain_gather(Mesh* mesh, lbm_comm_t const* mesh_comm,
+                          lbm_subdomain_t const* subdomain);
+
+#endif // LBM_SUBDOMAIN_H
@@ -1,3 +1,4 @@
+#include "../include/lbm_codec.h"
 #include "../include/lbm_struct.h"
 
 #include <assert.h>
@@ -14,7 +15,8 @@ typedef enum lbm_output_format_e {
     OUT_FORMAT_GNUPLOT,
     OUT_FORMAT_OCTAVE,
     OUT_FORMAT_CHECKSUM,
-    OUT_FORMAT_INFO
+    OUT_FORMAT_INFO,
+    OUT_FORMAT_INDEX
 } lbm_output_format_t;
 
 void fatal(const char* message)
@@ -23,6 +25,55 @@ void fatal(const char* message)
     abort();
 }
 
+/**
+ * @brief Loads the index of the frames from the footer of the file, if any.
+ * Leaves the file right after its header.
+ **/
+void read_index(lbm_data_file_t* file)
+{
+    file->index = NULL;
+    file->nb_frames = 0;
+    file->next_frame = 0;
+
+    struct stat info;
+    lbm_file_footer_t footer;
+    uint64_t const header_size = sizeof(lbm_file_header_t);
+    if (fstat(fileno(file->fp), &info) != 0 ||
+        (uint64_t)info.st_size < header_size + sizeof(footer) ||
+        fseeko(file->fp, info.st_size - sizeof(footer), SEEK_SET) != 0 ||
+        fread(&footer, sizeof(footer), 1, file->fp) != 1 ||
+        footer.magick != RESULT_MAGICK_INDEX ||
+        (uint64_t)footer.nb_frames * sizeof(lbm_file_index_entry_t) >
+            info.st_size - header_size - sizeof(footer)) {
+        // No index, e.g. the simulation was interrupted
+        fseeko(file->fp, header_size, SEEK_SET);
+        return;
+    }
+
+    uint64_t const index_offset =
+        info.st_size - sizeof(footer) -
+        (uint64_t)footer.nb_frames * sizeof(lbm_file_index_entry_t);
+    file->index = malloc(footer.nb_frames * sizeof(lbm_file_index_entry_t));
+    if (file->index == NULL && footer.nb_frames > 0) {
+        perror("malloc");
+        abort();
+    }
+    if (fseeko(file->fp, index_offset, SEEK_SET) != 0 ||
+        fread(file->index, sizeof(lbm_file_index_entry_t), footer.nb_frames,
+              file->fp) != footer.nb_frames) {
+        fatal("failed to read the frame index");
+    }
+    for (uint32_t i = 0; i < footer.nb_frames; i++) {
+        lbm_file_index_entry_t const* entry = &file->index[i];
+        if (entry->offset < header_size || entry->size > index_offset ||
+            entry->offset > index_offset - entry->size || entry->key > i) {
+            fatal("invalid frame index");
+        }
+    }
+    file->nb_frames = footer.nb_frames;
+    fseeko(file->fp, header_size, SEEK_SET);
+}
+
 void open_data_file(lbm_data_file_t* file, const char* fname)
 {
     assert(file != NULL);
@@ -46,12 +97,28 @@ void open_data_file(lbm_data_file_t* file, const char* fname)
     }
 
     // Check magick
-    if (file->header.magick != RESULT_MAGICK)
+    if (file->header.magick != RESULT_MAGICK &&
+        file->header.magick != RESULT_MAGICK_COMPRESSED &&
+        file->header.magick != RESULT_MAGICK_LOSSY)
         fatal("invalid file format");
 
     // Allocate memory
     file->entries = malloc(file->header.mesh_height * file->header.mesh_width *
                            sizeof(lbm_file_entry_t));
+
+    // Compressed frames are decoded against the previous one
+    file->codec = NULL;
+    if (file->header.magick != RESULT_MAGICK) {
+        file->codec = malloc(sizeof(lbm_codec_t));
+        if (file->codec == NULL) {
+            perror("malloc");
+            abort();
+        }
+        lbm_codec_init(file->codec, file->header.mesh_width,
+                       file->header.mesh_height);
+    }
+
+    read_index(file);
 }
 
 void close_data_file(lbm_data_file_t* file)
@@ -62,14 +129,42 @@ void close_data_file(lbm_data_file_t* file)
 
     fclose(file->fp);
     free(file->entries);
+    free(file->index);
+    if (file->codec != NULL) {
+        lbm_codec_release(file->codec);
+        free(file->codec);
+    }
 }
 
-bool read_next_frame(lbm_data_file_t* file)
+bool read_next_compressed_frame(lbm_data_file_t* file)
 {
-    assert(file != NULL);
-    assert(file->fp != NULL);
-    assert(file->entries != NULL);
+    lbm_codec_record_t record;
+    if (!fread(&record, sizeof(record), 1, file->fp)) {
+        if (feof(file->fp)) {
+            return false;
+        }
+        fatal("failed to read file");
+    }
+    if (record.size > file->codec->capacity) {
+        fatal("invalid compressed frame");
+    }
+    if (fread(file->codec->payload, 1, record.size, file->fp) != record.size) {
+        fatal("truncated compressed frame");
+    }
+    bool const valid =
+        (file->header.magick == RESULT_MAGICK_LOSSY)
+            ? lbm_codec_decode_lossy(file->codec, file->codec->payload,
+                                     record.size, file->entries)
+            : lbm_codec_decode(file->codec, file->codec->payload, record.size,
+                               file->entries);
+    if (!valid) {
+        fatal("invalid compressed frame");
+    }
+    return true;
+}
 
+bool read_next_raw_frame(lbm_data_file_t* file)
+{
     // Load the frame
     size_t res =
         fread(file->entries, sizeof(lbm_file_entry_t),
@@ -87,13 +182,78 @@ bool read_next_frame(lbm_data_file_t* file)
     }
 }
 
+bool read_next_frame(lbm_data_file_t* file)
+{
+    assert(file != NULL);
+    assert(file->fp != NULL);
+    assert(file->entries != NULL);
+
+    // The index ends the frames
+    if (file->index != NULL && file->next_frame >= file->nb_frames) {
+        return false;
+    }
+    bool const read = (file->codec != NULL) ? read_next_compressed_frame(file)
+                                            : read_next_raw_frame(file);
+    if (!read) {
+        return false;
+    }
+
+    // Frames are checked against the checksums computed by the simulation
+    if (file->index != NULL) {
+        uint32_t const area[4] = { 0, 0, file->header.mesh_width,
+                                   file->header.mesh_height };
+        if (lbm_codec_checksum(file->entries, area,
+                               file->header.mesh_height) !=
+            file->index[file->next_frame].checksum) {
+            fatal("frame does not match its checksum");
+        }
+    }
+    file->next_frame++;
+    return true;
+}
+
 bool seek_to_frame(lbm_data_file_t* file, int frame)
 {
-    int res = fseek(file->fp,
-                    frame * sizeof(lbm_file_entry_t) *
-                        file->header.mesh_height * file->header.mesh_width,
-                    SEEK_CUR);
-    return (res == 0);
+    // Frames are located by the index, compressed ones are decoded from the
+    // key frame they depend on
+    if (file->index != NULL) {
+        // There is nothing to read past the last frame
+        if ((uint32_t)frame >= file->nb_frames) {
+            file->next_frame = file->nb_frames;
+            return true;
+        }
+        uint32_t const key = (file->codec != NULL) ? file->index[frame].key
+                                                   : (uint32_t)frame;
+        if (file->codec != NULL) {
+            lbm_codec_seek(file->codec, key);
+        }
+        if (fseeko(file->fp, file->index[key].offset, SEEK_SET) != 0) {
+            return false;
+        }
+        file->next_frame = key;
+        for (uint32_t i = key; i < (uint32_t)frame; i++) {
+            if (!read_next_frame(file)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Each compressed frame depends on the previous ones
+    if (file->codec != NULL) {
+        for (int i = 0; i < frame; i++) {
+            if (!read_next_compressed_frame(file)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    off_t const offset = sizeof(lbm_file_header_t) +
+                         (off_t)frame * sizeof(lbm_file_entry_t) *
+                             file->header.mesh_height *
+                             file->header.mesh_width;
+    return fseeko(file->fp, offset, SEEK_SET) == 0;
 }
 
 void print_current_frame_gnuplot(lbm_data_file_t* file)
@@ -128,11 +288,48 @@ void do_checksum(lbm_data_file_t* file)
         }
     }
 
-    printf("%lX - %g\n", (uint64_t)checksum, checksum);
+    // Lossy frames also report how far they may be from the simulation
+    if (file->header.magick == RESULT_MAGICK_LOSSY) {
+        printf("%lX - %g (error bound %g, max error %g)\n", (uint64_t)checksum,
+               checksum, file->codec->error_bound, file->codec->max_error);
+    } else {
+        printf("%lX - %g\n", (uint64_t)checksum, checksum);
+    }
+}
+
+int get_compressed_frame_count(lbm_data_file_t* file)
+{
+    struct stat info;
+    if (fstat(fileno(file->fp), &info) != 0) {
+        return 0;
+    }
+
+    // Walk the complete records from the first frame, then come back
+    long const position = ftell(file->fp);
+    uint64_t offset = sizeof(lbm_file_header_t);
+    int count = 0;
+    lbm_codec_record_t record;
+    while (fseek(file->fp, offset, SEEK_SET) == 0 &&
+           fread(&record, sizeof(record), 1, file->fp) == 1) {
+        offset += sizeof(record) + record.size;
+        if (offset > (uint64_t)info.st_size) {
+            break;
+        }
+        count++;
+    }
+    fseek(file->fp, position, SEEK_SET);
+    return count;
 }
 
 int get_frame_count(lbm_data_file_t* file)
 {
+    if (file->index != NULL) {
+        return file->nb_frames;
+    }
+    if (file->codec != NULL) {
+        return get_compressed_frame_count(file);
+    }
+
     struct stat info;
     if (fstat(fileno(file->fp), &info) == 0) {
         return info.st_size /
@@ -150,6 +347,20 @@ void print_info(lbm_data_file_t* file)
     printf("frames = %d\n", get_frame_count(file));
 }
 
+void print_index(lbm_data_file_t* file)
+{
+    if (file->index == NULL) {
+        fatal("file has no frame index");
+    }
+    for (uint32_t i = 0; i < file->nb_frames; i++) {
+        lbm_file_index_entry_t const* entry = &file->index[i];
+        printf("frame %u: iteration = %u, offset = %lu, size = %lu, "
+               "key = %u, checksum = %016lX\n",
+               i, entry->iteration, entry->offset, entry->size, entry->key,
+               entry->checksum);
+    }
+}
+
 void print_current_frame(lbm_data_file_t* file, lbm_output_format_t format)
 {
     switch (format) {
@@ -166,6 +377,9 @@ void print_current_frame(lbm_data_file_t* file, lbm_output_format_t format)
         case OUT_FORMAT_CHECKSUM:
             do_checksum(file);
             break;
+        case OUT_FORMAT_INDEX:
+            print_index(file);
+            break;
     }
 }
 
@@ -174,6 +388,12 @@ void print_data(lbm_data_file_t* file, lbm_output_format_t format, int frame)
     assert(file != NULL);
     assert(frame >= 0);
 
+    // The index is printed without reading any frame
+    if (format == OUT_FORMAT_INDEX) {
+        print_index(file);
+        return;
+    }
+
     // Seek to frame
     if (seek_to_frame(file, frame) == false)
         fatal("failed to seek to the requested frame.");
@@ -192,7 +412,7 @@ int main(int argc, char* argv[])
     // Arg error
     if (argc != 4) {
         fprintf(stderr,
-                "Usage: %s --<gnuplot|octave|checksum|info> <file.raw> "
+                "Usage: %s --<gnuplot|octave|checksum|info|index> <file.raw> "
                 "<frame_id>\n",
                 argv[0]);
         abort();
@@ -208,6 +428,8 @@ int main(int argc, char* argv[])
         format = OUT_FORMAT_CHECKSUM;
     } else if (strcmp(argv[1], "--info") == 0) {
         format = OUT_FORMAT_INFO;
+    } else if (strcmp(argv[1], "--index") == 0) {
+        format = OUT_FORMAT_INDEX;
     } else {
         fatal("invalid format option");
     }
@@ -0,0 +1,344 @@
+#include "lbm_balance.h"
+
+#include "lbm_init.h"
+
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(lbm_cell_type_t) == sizeof(int),
+               "cell types are migrated as MPI_INT");
+
+/**
+ * @brief Tags of the migration messages.
+ **/
+typedef enum lbm_balance_tag_e {
+    TAG_MESH,
+    TAG_TEMP,
+    TAG_TYPES
+} lbm_balance_tag_t;
+
+void lbm_balance_init(lbm_balance_t* balance, uint32_t interval)
+{
+    balance->interval = interval;
+    balance->busy = 0.0;
+    balance->steps = 0;
+    balance->wait_before = 0.0;
+    balance->first_imbalance = 0.0;
+    balance->last_imbalance = 0.0;
+    balance->nb_moves = 0;
+    balance->migrated_columns = 0;
+    balance->time = 0.0;
+}
+
+void lbm_balance_begin_step(lbm_balance_t* balance,
+                            lbm_comm_t const* mesh_comm)
+{
+    balance->wait_before = mesh_comm->wait_time;
+}
+
+void lbm_balance_end_step(lbm_balance_t* balance, lbm_comm_t const* mesh_comm,
+                          double step_time)
+{
+    double const wait = mesh_comm->wait_time - balance->wait_before;
+    balance->busy += (step_time > wait) ? step_time - wait : 0.0;
+    balance->steps++;
+}
+
+/**
+ * @brief Busy time per step of the calling rank since the last attempt.
+ **/
+static double lbm_balance_local_cost(lbm_balance_t const* balance)
+{
+    return (balance->steps > 0) ? balance->busy / balance->steps : 0.0;
+}
+
+double lbm_balance_imbalance(lbm_balance_t const* balance,
+                             lbm_comm_t const* mesh_comm)
+{
+    int comm_size;
+    MPI_Comm_size(mesh_comm->comm, &comm_size);
+
+    double const cost = lbm_balance_local_cost(balance);
+    double max, sum;
+    MPI_Allreduce(&cost, &max, 1, MPI_DOUBLE, MPI_MAX, mesh_comm->comm);
+    MPI_Allreduce(&cost, &sum, 1, MPI_DOUBLE, MPI_SUM, mesh_comm->comm);
+    return (sum > 0.0) ? max * comm_size / sum : 1.0;
+}
+
+/**
+ * @brief Computes the new boundaries between columns of ranks, identically on
+ * every rank.
+ *
+ * Each column of ranks costs as much as its slowest rank, and the cost is
+ * assumed uniform over its columns of cells. Boundaries are placed at equal
+ * shares of the total cost, but never past the neighbouring boundaries so
+ * that columns are only exchanged between direct neighbours.
+ *
+ * @param mesh_comm Rank-level communicator.
+ * @param costs Cost of each column of ranks.
+ * @param bounds New boundaries (`nb_x + 1` entries).
+ * @return Whether a boundary moved.
+ **/
+static bool lbm_balance_new_bounds(lbm_comm_t const* mesh_comm,
+                                   double const* costs, uint32_t* bounds)
+{
+    int const nb_x = mesh_comm->nb_x;
+    uint32_t const* old = mesh_comm->x_bounds;
+
+    double total = 0.0;
+    for (int c = 0; c < nb_x; c++) {
+        if (costs[c] <= 0.0) {
+            return false;
+        }
+        total += costs[c];
+    }
+
+    bool moved = false;
+    bounds[0] = old[0];
+    bounds[nb_x] = old[nb_x];
+    int c = 0;
+    double acc = 0.0;
+    for (int i = 1; i < nb_x; i++) {
+        // Column of ranks containing the target share of the cost
+        double const target = total * i / nb_x;
+        while (acc + costs[c] < target) {
+            acc += costs[c];
+            c++;
+        }
+        double const fraction = (target - acc) / costs[c];
+        long pos = lround(old[c] + fraction * (old[c + 1] - old[c]));
+
+        // Only move towards cells owned by the direct neighbours, keeping at
+        // least one column per rank
+        long const lo = old[i - 1] + 1;
+        long const hi = old[i + 1] - 1;
+        pos = (pos < lo) ? lo : (pos > hi) ? hi : pos;
+        if (pos <= (long)bounds[i - 1]) {
+            pos = bounds[i - 1] + 1;
+        }
+        if (pos > hi) {
+            return false;
+        }
+
+        bounds[i] = pos;
+        moved |= (bounds[i] != old[i]);
+    }
+    return moved;
+}
+
+/**
+ * @brief Posts the non-blocking transfer of a range of columns of the three
+ * local arrays.
+ *
+ * @param requests Array of requests to fill (3 entries).
+ * @param recv Whether to receive or to send the columns.
+ * @param mesh Mesh holding the columns.
+ * @param temp Temporary mesh holding the columns.
+ * @param mesh_type Cell types holding the columns.
+ * @param first First local column.
+ * @param count Number of columns.
+ * @param target_rank Rank to communicate with.
+ * @param comm Communicator to use.
+ **/
+static void lbm_balance_transfer(MPI_Request* requests, bool recv, Mesh* mesh,
+                                 Mesh* temp, lbm_mesh_type_t* mesh_type,
+                                 uint32_t first, uint32_t count,
+                                 int target_rank, MPI_Comm comm)
+{
+    int const doubles = count * mesh->height * DIRECTIONS;
+    int const ints = count * mesh_type->height;
+    double* mesh_cols = Mesh_get_cell(mesh, first, 0);
+    double* temp_cols = Mesh_get_cell(temp, first, 0);
+    lbm_cell_type_t* type_cols = lbm_cell_type_t_get_cell(mesh_type, first, 0);
+
+    if (recv) {
+        MPI_Irecv(mesh_cols, doubles, MPI_DOUBLE, target_rank, TAG_MESH, comm,
+                  &requests[0]);
+        MPI_Irecv(temp_cols, doubles, MPI_DOUBLE, target_rank, TAG_TEMP, comm,
+                  &requests[1]);
+        MPI_Irecv(type_cols, ints, MPI_INT, target_rank, TAG_TYPES, comm,
+                  &requests[2]);
+    } else {
+        MPI_Isend(mesh_cols, doubles, MPI_DOUBLE, target_rank, TAG_MESH, comm,
+                  &requests[0]);
+        MPI_Isend(temp_cols, doubles, MPI_DOUBLE, target_rank, TAG_TEMP, comm,
+                  &requests[1]);
+        MPI_Isend(type_cols, ints, MPI_INT, target_rank, TAG_TYPES, comm,
+                  &requests[2]);
+    }
+}
+
+/**
+ * @brief Moves the local meshes to the area described by the new boundaries.
+ *
+ * Ghost cells are rebuilt from the initial state: they only hold constant
+ * boundary values between two steps, the others being exchanged at every
+ * step.
+ *
+ * @return Number of columns received.
+ **/
+static uint32_t lbm_balance_migrate(lbm_comm_t* mesh_comm, Mesh* mesh,
+                                    Mesh* temp, lbm_mesh_type_t* mesh_type)
+{
+    // Old area, inner columns only
+    uint32_t const old_begin = mesh_comm->x;
+    uint32_t const old_end = mesh_comm->x + mesh_comm->width - 2;
+
+    lbm_comm_update_area(mesh_comm);
+    uint32_t const new_begin = mesh_comm->x;
+    uint32_t const new_end = mesh_comm->x + mesh_comm->width - 2;
+
+    Mesh new_mesh, new_temp;
+    lbm_mesh_type_t new_type;
+    Mesh_init(&new_mesh, lbm_comm_width(mesh_comm), lbm_comm_height(mesh_comm));
+    Mesh_init(&new_temp, lbm_comm_width(mesh_comm), lbm_comm_height(mesh_comm));
+    lbm_mesh_type_t_init(&new_type, lbm_comm_width(mesh_comm),
+                         lbm_comm_height(mesh_comm));
+    setup_init_state(&new_mesh, &new_type, mesh_comm);
+    setup_init_state_copy(&new_temp, &new_mesh);
+
+    // Columns changing owner, local indices include the ghost column
+    MPI_Request requests[12];
+    int nb_requests = 0;
+    uint32_t received = 0;
+    if (new_begin < old_begin) {
+        received += old_begin - new_begin;
+        lbm_balance_transfer(&requests[nb_requests], true, &new_mesh,
+                             &new_temp, &new_type, 1, old_begin - new_begin,
+                             mesh_comm->left_id, mesh_comm->comm);
+        nb_requests += 3;
+    } else if (new_begin > old_begin) {
+        lbm_balance_transfer(&requests[nb_requests], false, mesh, temp,
+                             mesh_type, 1, new_begin - old_begin,
+                             mesh_comm->left_id, mesh_comm->comm);
+        nb_requests += 3;
+    }
+    if (new_end > old_end) {
+        received += new_end - old_end;
+        lbm_balance_transfer(&requests[nb_requests], true, &new_mesh,
+                             &new_temp, &new_type, old_end - new_begin + 1,
+                             new_end - old_end, mesh_comm->right_id,
+                             mesh_comm->comm);
+        nb_requests += 3;
+    } else if (new_end < old_end) {
+        lbm_balance_transfer(&requests[nb_requests], false, mesh, temp,
+                             mesh_type, new_end - old_begin + 1,
+                             old_end - new_end, mesh_comm->right_id,
+                             mesh_comm->comm);
+        nb_requests += 3;
+    }
+
+    // Columns kept by the rank
+    uint32_t const keep_begin = (new_begin > old_begin) ? new_begin : old_begin;
+    uint32_t const keep_end = (new_end < old_end) ? new_end : old_end;
+    if (keep_begin < keep_end) {
+        uint32_t const src = keep_begin - old_begin + 1;
+        uint32_t const dst = keep_begin - new_begin + 1;
+        uint32_t const count = keep_end - keep_begin;
+        memcpy(Mesh_get_cell(&new_mesh, dst, 0), Mesh_get_cell(mesh, src, 0),
+               count * mesh->height * DIRECTIONS * sizeof(double));
+        memcpy(Mesh_get_cell(&new_temp, dst, 0), Mesh_get_cell(temp, src, 0),
+               count * temp->height * DIRECTIONS * sizeof(double));
+        memcpy(lbm_cell_type_t_get_cell(&new_type, dst, 0),
+               lbm_cell_type_t_get_cell(mesh_type, src, 0),
+               count * mesh_type->height * sizeof(lbm_cell_type_t));
+    }
+
+    MPI_Waitall(nb_requests, requests, MPI_STATUSES_IGNORE);
+
+    Mesh_release(mesh);
+    Mesh_release(temp);
+    lbm_mesh_type_t_release(mesh_type);
+    *mesh = new_mesh;
+    *temp = new_temp;
+    *mesh_type = new_type;
+    return received;
+}
+
+bool lbm_balance_step(lbm_balance_t* balance, lbm_comm_t* mesh_comm,
+                      Mesh* mesh, Mesh* temp, lbm_mesh_type_t* mesh_type,
+                      uint32_t step)
+{
+    double const before = MPI_Wtime();
+    int rank, comm_size;
+    MPI_Comm_rank(mesh_comm->comm, &rank);
+    MPI_Comm_size(mesh_comm->comm, &comm_size);
+
+    double const imbalance = lbm_balance_imbalance(balance, mesh_comm);
+    if (balance->first_imbalance == 0.0) {
+        balance->first_imbalance = imbalance;
+    }
+    balance->last_imbalance = imbalance;
+
+    // Cost of each column of ranks: the one of its slowest rank
+    double const cost = lbm_balance_local_cost(balance);
+    double* all_costs = malloc(comm_size * sizeof(double));
+    double* costs = calloc(mesh_comm->nb_x, sizeof(double));
+    uint32_t* bounds = malloc((mesh_comm->nb_x + 1) * sizeof(uint32_t));
+    if (all_costs == NULL || costs == NULL || bounds == NULL) {
+        perror("malloc");
+        abort();
+    }
+    MPI_Allgather(&cost, 1, MPI_DOUBLE, all_costs, 1, MPI_DOUBLE,
+                  mesh_comm->comm);
+    for (int r = 0; r < comm_size; r++) {
+        int coords[2];
+        MPI_Cart_coords(mesh_comm->comm, r, 2, coords);
+        if (all_costs[r] > costs[coords[1]]) {
+            costs[coords[1]] = all_costs[r];
+        }
+    }
+
+    bool moved = false;
+    if (imbalance > LBM_BALANCE_TOLERANCE &&
+        lbm_balance_new_bounds(mesh_comm, costs, bounds)) {
+        memcpy(mesh_comm->x_bounds, bounds,
+               (mesh_comm->nb_x + 1) * sizeof(uint32_t));
+        balance->migrated_columns +=
+            lbm_balance_migrate(mesh_comm, mesh, temp, mesh_type);
+        balance->nb_moves++;
+        moved = true;
+    }
+
+    if (rank == RANK_MASTER) {
+        printf("Load balancing at step %u: imbalance %.3lf, %s\n", step,
+               imbalance, moved ? "boundaries moved" : "boundaries kept");
+    }
+
+    // Start a new measurement interval
+    balance->busy = 0.0;
+    balance->steps = 0;
+    free(all_costs);
+    free(costs);
+    free(bounds);
+    balance->time += MPI_Wtime() - before;
+    return moved;
+}
+
+void lbm_balance_print(lbm_balance_t const* balance,
+                       lbm_comm_t const* mesh_comm)
+{
+    int rank;
+    MPI_Comm_rank(mesh_comm->comm, &rank);
+
+    double const imbalance = (balance->steps > 0)
+                                 ? lbm_balance_imbalance(balance, mesh_comm)
+                                 : balance->last_imbalance;
+    uint64_t migrated;
+    double time;
+    MPI_Reduce(&balance->migrated_columns, &migrated, 1, MPI_UINT64_T, MPI_SUM,
+               RANK_MASTER, mesh_comm->comm);
+    MPI_Reduce(&balance->time, &time, 1, MPI_DOUBLE, MPI_MAX, RANK_MASTER,
+               mesh_comm->comm);
+
+    if (rank == RANK_MASTER) {
+        printf("Global load imbalance:              %.3lf before balancing, "
+               "%.3lf after (%u moves, %lu columns migrated in %.6lfs)\n",
+               (balance->first_imbalance > 0.0) ? balance->first_imbalance
+                                                : imbalance,
+               imbalance, balance->nb_moves, migrated, time);
+    }
+}
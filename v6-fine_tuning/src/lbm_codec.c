@@ -0,0 +1,460 @@
+#include "lbm_codec.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Sum of the symbol frequencies of a plane.
+#define LBM_CODEC_SCALE (1u << LBM_CODEC_SCALE_BITS)
+/// Lower bound of the rANS state, renormalized one byte at a time.
+#define LBM_CODEC_RANS_L (1u << 23)
+/// Plane stored as is.
+#define LBM_CODEC_RAW 0
+/// Plane compressed with rANS.
+#define LBM_CODEC_RANS 1
+/// Size of the header of a plane: mode and length of its data.
+#define LBM_CODEC_PLANE_HEADER 5
+/// Size of the frequency table of a rANS plane.
+#define LBM_CODEC_TABLE (256 * sizeof(uint16_t))
+/// Size of the header of a lossy frame: requested and achieved errors.
+#define LBM_CODEC_LOSSY_HEADER (2 * sizeof(double))
+/// Quantized value of a quantity stored exactly after the planes of a lossy
+/// frame, as no quantized value is within the error bound.
+#define LBM_CODEC_EXACT ((uint32_t)INT32_MIN)
+
+static inline void lbm_codec_write_u32(uint8_t* out, uint32_t value)
+{
+    memcpy(out, &value, sizeof(value));
+}
+
+static inline uint32_t lbm_codec_read_u32(uint8_t const* in)
+{
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Predicts the bits of a quantity of a cell.
+ *
+ * @param codec Codec holding the previous frame.
+ * @param words Bits of the quantities of the current frame, up to the cell.
+ * @param i Index of the quantity of the cell in `words`.
+ * @return Predicted bits.
+ **/
+static inline uint32_t lbm_codec_predict(lbm_codec_t const* codec,
+                                         uint32_t const* words, size_t i)
+{
+    uint32_t prediction = codec->previous[i];
+    if ((i / 2) % codec->height != 0) {
+        prediction += words[i - 2] - codec->previous[i - 2];
+    }
+    return prediction;
+}
+
+void lbm_codec_init(lbm_codec_t* codec, size_t width, size_t height)
+{
+    size_t const nb_cells = width * height;
+    codec->nb_cells = nb_cells;
+    codec->height = height;
+    codec->nb_frames = 0;
+    codec->error_bound = 0.0;
+    codec->max_error = 0.0;
+    codec->previous = calloc(2 * nb_cells, sizeof(uint32_t));
+    codec->words = malloc(2 * nb_cells * sizeof(uint32_t));
+    codec->planes = malloc(LBM_CODEC_PLANES * nb_cells);
+    // Lossy frames may also store every quantity exactly
+    codec->capacity = LBM_CODEC_LOSSY_HEADER +
+                      LBM_CODEC_PLANES * (LBM_CODEC_PLANE_HEADER +
+                                          LBM_CODEC_TABLE + nb_cells) +
+                      2 * nb_cells * sizeof(float);
+    codec->payload = malloc(codec->capacity);
+    // A symbol costs at most `LBM_CODEC_SCALE_BITS` bits, plus the final state
+    codec->scratch = malloc(2 * nb_cells + 16);
+    if (codec->previous == NULL || codec->words == NULL ||
+        codec->planes == NULL || codec->payload == NULL ||
+        codec->scratch == NULL) {
+        perror("malloc");
+        abort();
+    }
+}
+
+void lbm_codec_release(lbm_codec_t* codec)
+{
+    free(codec->previous);
+    free(codec->words);
+    free(codec->planes);
+    free(codec->payload);
+    free(codec->scratch);
+}
+
+void lbm_codec_seek(lbm_codec_t* codec, uint32_t frame)
+{
+    codec->nb_frames = frame;
+}
+
+/**
+ * @brief Mixes the bits of a word and of its position (splitmix64 finalizer).
+ *
+ * @param x Position in the upper half, word in the lower half.
+ * @return Hash of the word.
+ **/
+static inline uint64_t lbm_codec_mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+uint64_t lbm_codec_checksum(lbm_file_entry_t const* entries,
+                            uint32_t const area[4], uint32_t height)
+{
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < area[2]; i++) {
+        for (uint32_t j = 0; j < area[3]; j++) {
+            uint32_t words[2];
+            memcpy(words, &entries[(size_t)i * area[3] + j], sizeof(words));
+            uint64_t const cell =
+                (uint64_t)(area[0] + i) * height + area[1] + j;
+            checksum += lbm_codec_mix((2 * cell) << 32 | words[0]);
+            checksum += lbm_codec_mix((2 * cell + 1) << 32 | words[1]);
+        }
+    }
+    return checksum;
+}
+
+/**
+ * @brief Scales the symbol counts of a plane to frequencies summing to
+ * `LBM_CODEC_SCALE`, keeping every present symbol.
+ *
+ * @param counts Number of occurrences of each symbol.
+ * @param n Number of symbols of the plane.
+ * @param freqs Scaled frequencies.
+ **/
+static void lbm_codec_normalize(uint32_t const counts[256], size_t n,
+                                uint16_t freqs[256])
+{
+    uint32_t total = 0;
+    int largest = 0;
+    for (int s = 0; s < 256; s++) {
+        freqs[s] = 0;
+        if (counts[s] > 0) {
+            uint64_t const f = ((uint64_t)counts[s] << LBM_CODEC_SCALE_BITS) / n;
+            freqs[s] = (f > 0) ? f : 1;
+        }
+        total += freqs[s];
+        largest = (counts[s] > counts[largest]) ? s : largest;
+    }
+
+    // Rounding errors are absorbed by the most frequent symbols
+    while (total > LBM_CODEC_SCALE) {
+        int max = 0;
+        for (int s = 1; s < 256; s++) {
+            max = (freqs[s] > freqs[max]) ? s : max;
+        }
+        freqs[max]--;
+        total--;
+    }
+    freqs[largest] += LBM_CODEC_SCALE - total;
+}
+
+/**
+ * @brief Compresses a byte plane.
+ *
+ * @param codec Codec providing the scratch buffer.
+ * @param data Plane to compress.
+ * @param n Size of the plane.
+ * @param out Encoded plane.
+ * @return Size of the encoded plane.
+ **/
+static size_t lbm_codec_encode_plane(lbm_codec_t* codec, uint8_t const* data,
+                                     size_t n, uint8_t* out)
+{
+    uint32_t counts[256] = { 0 };
+    for (size_t i = 0; i < n; i++) {
+        counts[data[i]]++;
+    }
+    uint16_t freqs[256];
+    uint32_t cumul[256];
+    if (n > 0) {
+        lbm_codec_normalize(counts, n, freqs);
+        cumul[0] = 0;
+        for (int s = 1; s < 256; s++) {
+            cumul[s] = cumul[s - 1] + freqs[s - 1];
+        }
+    }
+
+    // rANS encodes backwards, from the end of the scratch buffer
+    uint8_t* const end = codec->scratch + 2 * n + 16;
+    uint8_t* ptr = end;
+    uint32_t x = LBM_CODEC_RANS_L;
+    for (size_t i = n; i-- > 0;) {
+        uint32_t const f = freqs[data[i]];
+        uint32_t const x_max =
+            ((LBM_CODEC_RANS_L >> LBM_CODEC_SCALE_BITS) << 8) * f;
+        while (x >= x_max) {
+            *--ptr = x & 0xff;
+            x >>= 8;
+        }
+        x = ((x / f) << LBM_CODEC_SCALE_BITS) + (x % f) + cumul[data[i]];
+    }
+    ptr -= sizeof(x);
+    lbm_codec_write_u32(ptr, x);
+    size_t const encoded = end - ptr;
+
+    if (n == 0 || LBM_CODEC_TABLE + encoded >= n) {
+        out[0] = LBM_CODEC_RAW;
+        lbm_codec_write_u32(&out[1], n);
+        memcpy(&out[LBM_CODEC_PLANE_HEADER], data, n);
+        return LBM_CODEC_PLANE_HEADER + n;
+    }
+    out[0] = LBM_CODEC_RANS;
+    lbm_codec_write_u32(&out[1], encoded);
+    memcpy(&out[LBM_CODEC_PLANE_HEADER], freqs, LBM_CODEC_TABLE);
+    memcpy(&out[LBM_CODEC_PLANE_HEADER + LBM_CODEC_TABLE], ptr, encoded);
+    return LBM_CODEC_PLANE_HEADER + LBM_CODEC_TABLE + encoded;
+}
+
+/**
+ * @brief Decompresses a byte plane.
+ *
+ * @param in Encoded plane.
+ * @param available Number of bytes readable from `in`.
+ * @param n Size of the plane.
+ * @param data Decoded plane.
+ * @return Size of the encoded plane, 0 if it is malformed.
+ **/
+static size_t lbm_codec_decode_plane(uint8_t const* in, size_t available,
+                                     size_t n, uint8_t* data)
+{
+    if (available < LBM_CODEC_PLANE_HEADER) {
+        return 0;
+    }
+    size_t const length = lbm_codec_read_u32(&in[1]);
+    if (in[0] == LBM_CODEC_RAW) {
+        if (length != n || available < LBM_CODEC_PLANE_HEADER + n) {
+            return 0;
+        }
+        memcpy(data, &in[LBM_CODEC_PLANE_HEADER], n);
+        return LBM_CODEC_PLANE_HEADER + n;
+    }
+    size_t const size = LBM_CODEC_PLANE_HEADER + LBM_CODEC_TABLE + length;
+    if (in[0] != LBM_CODEC_RANS || available < size || length < 4) {
+        return 0;
+    }
+
+    uint16_t freqs[256];
+    uint32_t cumul[256];
+    memcpy(freqs, &in[LBM_CODEC_PLANE_HEADER], LBM_CODEC_TABLE);
+    uint8_t symbols[LBM_CODEC_SCALE];
+    uint32_t total = 0;
+    for (int s = 0; s < 256; s++) {
+        if (total + freqs[s] > LBM_CODEC_SCALE) {
+            return 0;
+        }
+        cumul[s] = total;
+        memset(&symbols[total], s, freqs[s]);
+        total += freqs[s];
+    }
+    if (total != LBM_CODEC_SCALE) {
+        return 0;
+    }
+
+    uint8_t const* ptr = &in[LBM_CODEC_PLANE_HEADER + LBM_CODEC_TABLE];
+    uint8_t const* const end = ptr + length;
+    uint32_t x = lbm_codec_read_u32(ptr);
+    ptr += sizeof(x);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t const slot = x & (LBM_CODEC_SCALE - 1);
+        uint8_t const s = symbols[slot];
+        data[i] = s;
+        x = freqs[s] * (x >> LBM_CODEC_SCALE_BITS) + slot - cumul[s];
+        while (x < LBM_CODEC_RANS_L) {
+            if (ptr == end) {
+                return 0;
+            }
+            x = (x << 8) | *ptr++;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Encodes the words of a frame, predicted from the previous ones.
+ *
+ * @param codec Codec holding the previous words.
+ * @param words Words to encode.
+ * @param out Encoded words.
+ * @return Size of the encoded words.
+ **/
+static size_t lbm_codec_encode_words(lbm_codec_t* codec,
+                                     uint32_t const* words, uint8_t* out)
+{
+    size_t const n = codec->nb_cells;
+    if (codec->nb_frames++ % LBM_CODEC_KEY_INTERVAL == 0) {
+        memset(codec->previous, 0, 2 * n * sizeof(uint32_t));
+    }
+
+    // Zigzag-encoded residuals, one plane per byte of each quantity
+    for (size_t i = 0; i < 2 * n; i++) {
+        int32_t const residual = words[i] - lbm_codec_predict(codec, words, i);
+        uint32_t const zigzag =
+            ((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31);
+        uint8_t* const plane = &codec->planes[(i % 2) * 4 * n + i / 2];
+        for (int b = 0; b < 4; b++) {
+            plane[b * n] = zigzag >> (8 * b);
+        }
+    }
+    memcpy(codec->previous, words, 2 * n * sizeof(uint32_t));
+
+    size_t size = 0;
+    for (int p = 0; p < LBM_CODEC_PLANES; p++) {
+        size += lbm_codec_encode_plane(codec, &codec->planes[p * n], n,
+                                       &out[size]);
+    }
+    return size;
+}
+
+/**
+ * @brief Decodes the words of a frame, predicted from the previous ones.
+ *
+ * @param codec Codec holding the previous words.
+ * @param in Encoded words.
+ * @param available Number of bytes readable from `in`.
+ * @param words Decoded words.
+ * @return Size of the encoded words, 0 if they are malformed.
+ **/
+static size_t lbm_codec_decode_words(lbm_codec_t* codec, uint8_t const* in,
+                                     size_t available, uint32_t* words)
+{
+    size_t const n = codec->nb_cells;
+    if (codec->nb_frames++ % LBM_CODEC_KEY_INTERVAL == 0) {
+        memset(codec->previous, 0, 2 * n * sizeof(uint32_t));
+    }
+    size_t offset = 0;
+    for (int p = 0; p < LBM_CODEC_PLANES; p++) {
+        size_t const consumed =
+            lbm_codec_decode_plane(&in[offset], available - offset, n,
+                                   &codec->planes[p * n]);
+        if (consumed == 0) {
+            return 0;
+        }
+        offset += consumed;
+    }
+
+    for (size_t i = 0; i < 2 * n; i++) {
+        uint8_t const* const plane = &codec->planes[(i % 2) * 4 * n + i / 2];
+        uint32_t zigzag = 0;
+        for (int b = 0; b < 4; b++) {
+            zigzag |= (uint32_t)plane[b * n] << (8 * b);
+        }
+        uint32_t const residual = (zigzag >> 1) ^ -(zigzag & 1);
+        words[i] = lbm_codec_predict(codec, words, i) + residual;
+    }
+    memcpy(codec->previous, words, 2 * n * sizeof(uint32_t));
+    return offset;
+}
+
+/**
+ * @brief Reconstructs a quantity from its quantized value.
+ *
+ * @param word Quantized value.
+ * @param step Quantization step.
+ * @return Reconstructed quantity.
+ **/
+static inline float lbm_codec_dequantize(uint32_t word, double step)
+{
+    return (float)((int32_t)word * step);
+}
+
+size_t lbm_codec_encode(lbm_codec_t* codec, lbm_file_entry_t const* frame)
+{
+    return lbm_codec_encode_words(codec, (uint32_t const*)frame,
+                                  codec->payload);
+}
+
+bool lbm_codec_decode(lbm_codec_t* codec, uint8_t const* payload, size_t size,
+                      lbm_file_entry_t* frame)
+{
+    return lbm_codec_decode_words(codec, payload, size, (uint32_t*)frame) ==
+           size;
+}
+
+size_t lbm_codec_encode_lossy(lbm_codec_t* codec, lbm_file_entry_t* frame,
+                              double error_bound)
+{
+    size_t const n = codec->nb_cells;
+    float* values = (float*)frame;
+    double const step = 2.0 * error_bound;
+
+    // Round to the nearest multiple of the step, unless the float
+    // reconstruction would be off by more than the bound
+    double max_error = 0.0;
+    for (size_t i = 0; i < 2 * n; i++) {
+        double const q = nearbyint(values[i] / step);
+        if (fabs(q) < INT32_MAX) {
+            uint32_t const word = (uint32_t)(int32_t)q;
+            float const value = lbm_codec_dequantize(word, step);
+            double const error = fabs((double)value - values[i]);
+            if (error <= error_bound) {
+                codec->words[i] = word;
+                max_error = (error > max_error) ? error : max_error;
+                values[i] = value;
+                continue;
+            }
+        }
+        codec->words[i] = LBM_CODEC_EXACT;
+    }
+    codec->error_bound = error_bound;
+    codec->max_error = max_error;
+
+    memcpy(codec->payload, &codec->error_bound, sizeof(double));
+    memcpy(&codec->payload[sizeof(double)], &codec->max_error,
+           sizeof(double));
+    size_t size = LBM_CODEC_LOSSY_HEADER;
+    size += lbm_codec_encode_words(codec, codec->words, &codec->payload[size]);
+    for (size_t i = 0; i < 2 * n; i++) {
+        if (codec->words[i] == LBM_CODEC_EXACT) {
+            memcpy(&codec->payload[size], &values[i], sizeof(float));
+            size += sizeof(float);
+        }
+    }
+    return size;
+}
+
+bool lbm_codec_decode_lossy(lbm_codec_t* codec, uint8_t const* payload,
+                            size_t size, lbm_file_entry_t* frame)
+{
+    size_t const n = codec->nb_cells;
+    if (size < LBM_CODEC_LOSSY_HEADER) {
+        return false;
+    }
+    memcpy(&codec->error_bound, payload, sizeof(double));
+    memcpy(&codec->max_error, &payload[sizeof(double)], sizeof(double));
+    if (!(codec->error_bound > 0.0)) {
+        return false;
+    }
+    size_t const consumed =
+        lbm_codec_decode_words(codec, &payload[LBM_CODEC_LOSSY_HEADER],
+                               size - LBM_CODEC_LOSSY_HEADER, codec->words);
+    if (consumed == 0) {
+        return false;
+    }
+
+    float* values = (float*)frame;
+    double const step = 2.0 * codec->error_bound;
+    size_t offset = LBM_CODEC_LOSSY_HEADER + consumed;
+    for (size_t i = 0; i < 2 * n; i++) {
+        if (codec->words[i] != LBM_CODEC_EXACT) {
+            values[i] = lbm_codec_dequantize(codec->words[i], step);
+        } else if (offset + sizeof(float) <= size) {
+            memcpy(&values[i], &payload[offset], sizeof(float));
+            offset += sizeof(float);
+        } else {
+            return false;
+        }
+    }
+    return offset == size;
+}
@@ -1,24 +1,17 @@
 #include "lbm_comm.h"
 
+#include "lbm_barrier.h"
+#include "lbm_phys.h"
+
 #include <assert.h>
 #include <math.h>
 #include <omp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-int lbm_helper_pgcd(int a, int b)
-{
-    int c;
-    while (b != 0) {
-        c = a % b;
-        a = b;
-        b = c;
-    }
-    return a;
-}
-
 /**
  * @brief Displays the configuration of the `lbm_comm` for a given rank.
  *
@@ -27,7 +20,7 @@ int lbm_helper_pgcd(int a, int b)
 void lbm_comm_print(lbm_comm_t const* mesh_comm)
 {
     int rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_rank(mesh_comm->comm, &rank);
     printf("\033[1mRank \033[33m%d\033[0m: L = %2d, R = %2d, T = %2d, B = %2d "
            "| CORNER: "
            "%2d, %2d, %2d, %2d | POS: %3d %3d (W = %3d, H = %3d)\n",
@@ -38,12 +31,418 @@ void lbm_comm_print(lbm_comm_t const* mesh_comm)
            mesh_comm->width, mesh_comm->height);
 }
 
-int helper_get_rank_id(int nb_x, int nb_y, int rank_x, int rank_y)
+int lbm_comm_crossing_directions(int dx, int dy, int directions[DIRECTIONS])
+{
+    int count = 0;
+    for (int k = 0; k < DIRECTIONS; k++) {
+        if ((dx == 0 || direction_a[k] == dx) &&
+            (dy == 0 || direction_b[k] == dy)) {
+            directions[count++] = k;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Builds the datatype of a single cell restricted to the populations
+ * leaving through a side or a corner, with the extent of a full cell.
+ *
+ * @param dx X component of the outward normal.
+ * @param dy Y component of the outward normal.
+ * @return Datatype (not committed).
+ **/
+static MPI_Datatype lbm_comm_cell_type(int dx, int dy)
+{
+    int directions[DIRECTIONS];
+    int const count = lbm_comm_crossing_directions(dx, dy, directions);
+
+    MPI_Datatype cell_type, resized_type;
+    MPI_Type_create_indexed_block(count, 1, directions, MPI_DOUBLE, &cell_type);
+    MPI_Type_create_resized(cell_type, 0, DIRECTIONS * sizeof(double),
+                            &resized_type);
+    MPI_Type_free(&cell_type);
+    return resized_type;
+}
+
+/**
+ * @brief Builds the datatype of the inner cells of a column restricted to the
+ * populations leaving through a side. Deep halos exchange whole cells of
+ * `ghost` columns, as their inner ghost layers are collided again.
+ *
+ * @param height Height of the mesh (phantom meshes included).
+ * @param ghost Number of phantom layers.
+ * @param dx X component of the side's outward normal.
+ * @return Committed datatype.
+ **/
+static MPI_Datatype lbm_comm_column_type(uint32_t height, uint32_t ghost,
+                                         int dx)
+{
+    MPI_Datatype column_type;
+    if (ghost == 1) {
+        MPI_Datatype cell_type = lbm_comm_cell_type(dx, 0);
+        MPI_Type_contiguous(height - 2, cell_type, &column_type);
+        MPI_Type_free(&cell_type);
+    } else {
+        MPI_Type_vector(ghost, (height - 2 * ghost) * DIRECTIONS,
+                        height * DIRECTIONS, MPI_DOUBLE, &column_type);
+    }
+    MPI_Type_commit(&column_type);
+    return column_type;
+}
+
+/**
+ * @brief Builds the datatype of the inner cells of a row restricted to the
+ * populations leaving through a side. Cells of a row are `height` cells apart
+ * in the column-major layout. Deep halos exchange whole cells of `ghost` rows.
+ *
+ * @param width Width of the mesh (phantom meshes included).
+ * @param height Height of the mesh (phantom meshes included).
+ * @param ghost Number of phantom layers.
+ * @param dy Y component of the side's outward normal.
+ * @return Committed datatype.
+ **/
+static MPI_Datatype lbm_comm_row_type(uint32_t width, uint32_t height,
+                                      uint32_t ghost, int dy)
+{
+    MPI_Datatype row_type;
+    if (ghost == 1) {
+        MPI_Datatype cell_type = lbm_comm_cell_type(0, dy);
+        MPI_Type_vector(width - 2, 1, height, cell_type, &row_type);
+        MPI_Type_free(&cell_type);
+    } else {
+        MPI_Type_vector(width - 2 * ghost, ghost * DIRECTIONS,
+                        height * DIRECTIONS, MPI_DOUBLE, &row_type);
+    }
+    MPI_Type_commit(&row_type);
+    return row_type;
+}
+
+/**
+ * @brief Builds the datatype of a corner cell restricted to the populations
+ * leaving through it. Deep halos exchange whole cells of a `ghost` x `ghost`
+ * block.
+ *
+ * @param height Height of the mesh (phantom meshes included).
+ * @param ghost Number of phantom layers.
+ * @param dx X component of the corner's outward normal.
+ * @param dy Y component of the corner's outward normal.
+ * @return Committed datatype.
+ **/
+static MPI_Datatype lbm_comm_corner_type(uint32_t height, uint32_t ghost,
+                                         int dx, int dy)
+{
+    MPI_Datatype corner_type;
+    if (ghost == 1) {
+        corner_type = lbm_comm_cell_type(dx, dy);
+    } else {
+        MPI_Type_vector(ghost, ghost * DIRECTIONS, height * DIRECTIONS,
+                        MPI_DOUBLE, &corner_type);
+    }
+    MPI_Type_commit(&corner_type);
+    return corner_type;
+}
+
+void lbm_comm_print_stats(lbm_comm_t const* mesh_comm, int rank)
+{
+    printf("\033[1mRank \033[33m%d\033[0m: halo exchange:              "
+           "\033[36m%lu\033[0m bytes sent in %lu messages\n",
+           rank, mesh_comm->bytes_sent, mesh_comm->messages_sent);
+    if (mesh_comm->backend == HALO_SHARED) {
+        printf("\033[1mRank \033[33m%d\033[0m: shared-memory halo:         "
+               "\033[36m%lu\033[0m bytes copied from %d neighbours\n",
+               rank, mesh_comm->bytes_copied, mesh_comm->nb_peers);
+    }
+}
+
+void lbm_comm_rank_area(lbm_comm_t const* mesh_comm, int rank, uint32_t* x,
+                        uint32_t* y, uint32_t* width, uint32_t* height)
+{
+    int coords[2];
+    MPI_Cart_coords(mesh_comm->comm, rank, 2, coords);
+
+    *x = mesh_comm->x_bounds[coords[1]];
+    *y = lbm_comm_split(mesh_comm->total_height, mesh_comm->nb_y, coords[0]);
+    *width = mesh_comm->x_bounds[coords[1] + 1] - *x + 2 * mesh_comm->ghost;
+    *height = lbm_comm_split(mesh_comm->total_height, mesh_comm->nb_y,
+                             coords[0] + 1) - *y + 2 * mesh_comm->ghost;
+}
+
+/**
+ * @brief Rank of a process in the Cartesian communicator given its position,
+ * -1 if outside of the grid.
+ **/
+int helper_get_rank_id(MPI_Comm comm, int nb_x, int nb_y, int rank_x,
+                       int rank_y)
 {
     if ((rank_x < 0 || rank_x >= nb_x) || (rank_y < 0 || rank_y >= nb_y)) {
         return -1;
     }
-    return (rank_x + rank_y * nb_x);
+    int const coords[2] = { rank_y, rank_x };
+    int rank;
+    MPI_Cart_rank(comm, coords, &rank);
+    return rank;
+}
+
+/**
+ * @brief Neighbour of the calling process along a dimension of the Cartesian
+ * communicator, -1 if none.
+ **/
+static int helper_get_neighbour_id(MPI_Comm comm, int dimension, int shift)
+{
+    int source, dest;
+    MPI_Cart_shift(comm, dimension, shift, &source, &dest);
+    return (dest == MPI_PROC_NULL) ? -1 : dest;
+}
+
+/**
+ * @brief Messages exchanged with one neighbour.
+ **/
+typedef struct lbm_comm_neighbour_s {
+    /// Rank of the neighbour.
+    int rank;
+    /// First cell sent and its datatype.
+    uint32_t send_x;
+    uint32_t send_y;
+    MPI_Datatype send_type;
+    /// First ghost cell received and its datatype.
+    uint32_t recv_x;
+    uint32_t recv_y;
+    MPI_Datatype recv_type;
+} lbm_comm_neighbour_t;
+
+/**
+ * @brief Lists the existing neighbours of the local mesh and what is
+ * exchanged with them, always in the same order.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param neighbours Filled with the existing neighbours.
+ * @return Number of neighbours.
+ **/
+static int lbm_comm_neighbours(lbm_comm_t const* mesh_comm,
+                               lbm_comm_neighbour_t neighbours[NB_NEIGHBOURS])
+{
+    // First owned layer, first of the last `ghost` owned layers, and first
+    // ghost layer on the far side
+    uint32_t const first = mesh_comm->ghost;
+    uint32_t const send_x = mesh_comm->width - 2 * mesh_comm->ghost;
+    uint32_t const send_y = mesh_comm->height - 2 * mesh_comm->ghost;
+    uint32_t const recv_x = mesh_comm->width - mesh_comm->ghost;
+    uint32_t const recv_y = mesh_comm->height - mesh_comm->ghost;
+    MPI_Datatype const* sides = mesh_comm->side_types;
+    MPI_Datatype const* corners = mesh_comm->corner_types;
+    lbm_comm_neighbour_t const all[NB_NEIGHBOURS] = {
+        { mesh_comm->left_id, first, first, sides[SIDE_LEFT], 0, first,
+          sides[SIDE_RIGHT] },
+        { mesh_comm->right_id, send_x, first, sides[SIDE_RIGHT], recv_x, first,
+          sides[SIDE_LEFT] },
+        { mesh_comm->top_id, first, first, sides[SIDE_TOP], first, 0,
+          sides[SIDE_BOTTOM] },
+        { mesh_comm->bottom_id, first, send_y, sides[SIDE_BOTTOM], first,
+          recv_y, sides[SIDE_TOP] },
+        { mesh_comm->corner_id[CORNER_TOP_LEFT], first, first,
+          corners[CORNER_TOP_LEFT], 0, 0, corners[CORNER_BOTTOM_RIGHT] },
+        { mesh_comm->corner_id[CORNER_TOP_RIGHT], send_x, first,
+          corners[CORNER_TOP_RIGHT], recv_x, 0, corners[CORNER_BOTTOM_LEFT] },
+        { mesh_comm->corner_id[CORNER_BOTTOM_LEFT], first, send_y,
+          corners[CORNER_BOTTOM_LEFT], 0, recv_y, corners[CORNER_TOP_RIGHT] },
+        { mesh_comm->corner_id[CORNER_BOTTOM_RIGHT], send_x, send_y,
+          corners[CORNER_BOTTOM_RIGHT], recv_x, recv_y,
+          corners[CORNER_TOP_LEFT] },
+    };
+
+    int count = 0;
+    for (int i = 0; i < NB_NEIGHBOURS; i++) {
+        if (all[i].rank != -1) {
+            neighbours[count++] = all[i];
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Chooses the grid of ranks minimizing the total length of the
+ * boundaries between subdomains, i.e. the halo volume.
+ *
+ * @param comm_size Number of ranks.
+ * @param width Width of the mesh.
+ * @param height Height of the mesh.
+ * @param nb_x Number of ranks along X.
+ * @param nb_y Number of ranks along Y.
+ **/
+static void lbm_comm_choose_grid(int comm_size, uint32_t width,
+                                 uint32_t height, int* nb_x, int* nb_y)
+{
+    uint64_t best_cost = UINT64_MAX;
+    for (int x = 1; x <= comm_size; x++) {
+        int const y = comm_size / x;
+        if (x * y != comm_size || (uint32_t)x > width || (uint32_t)y > height) {
+            continue;
+        }
+        uint64_t const cost =
+            (uint64_t)(x - 1) * height + (uint64_t)(y - 1) * width;
+        if (cost < best_cost) {
+            best_cost = cost;
+            *nb_x = x;
+            *nb_y = y;
+        }
+    }
+
+    if (best_cost == UINT64_MAX) {
+        fatal("Can't get a 2D cut for current problem size and number of "
+              "processes.");
+    }
+}
+
+/**
+ * @brief Identifies the node of every compute rank by the first rank running
+ * on it. Collective over `world`.
+ *
+ * @param world Communicator of the compute ranks.
+ * @param comm_size Number of ranks.
+ * @return Node of each rank, to be freed by the caller.
+ **/
+static int* lbm_comm_world_nodes(MPI_Comm world, int comm_size)
+{
+    int rank;
+    MPI_Comm_rank(world, &rank);
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &node_comm);
+    int first = rank;
+    MPI_Bcast(&first, 1, MPI_INT, 0, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    int* nodes = malloc(comm_size * sizeof(int));
+    if (nodes == NULL) {
+        perror("malloc");
+        abort();
+    }
+    MPI_Allgather(&first, 1, MPI_INT, nodes, 1, MPI_INT, world);
+    return nodes;
+}
+
+/**
+ * @brief Chooses the tile of the grid of ranks given to each node, minimizing
+ * the total length of the boundaries between tiles, i.e. the inter-node halo
+ * volume.
+ *
+ * @param node_size Number of ranks per node.
+ * @param nb_x Number of ranks along X.
+ * @param nb_y Number of ranks along Y.
+ * @param width Width of the mesh.
+ * @param height Height of the mesh.
+ * @param tile_x Number of ranks of a tile along X.
+ * @param tile_y Number of ranks of a tile along Y.
+ * @return Whether the grid can be tiled by nodes.
+ **/
+static bool lbm_comm_choose_tile(int node_size, int nb_x, int nb_y,
+                                 uint32_t width, uint32_t height, int* tile_x,
+                                 int* tile_y)
+{
+    uint64_t best_cost = UINT64_MAX;
+    for (int x = 1; x <= node_size; x++) {
+        int const y = node_size / x;
+        if (x * y != node_size || nb_x % x != 0 || nb_y % y != 0) {
+            continue;
+        }
+        uint64_t const cost = (uint64_t)(nb_x / x - 1) * height +
+                              (uint64_t)(nb_y / y - 1) * width;
+        if (cost < best_cost) {
+            best_cost = cost;
+            *tile_x = x;
+            *tile_y = y;
+        }
+    }
+    return best_cost != UINT64_MAX;
+}
+
+/**
+ * @brief Position in the grid of ranks (numbered along X) of a compute rank,
+ * such that the ranks of a node get a compact tile of the
+ * grid.
+ *
+ * Ranks are ordered by node then by rank. When all the nodes run as many
+ * ranks and the grid can be tiled accordingly, the n-th node gets the n-th
+ * tile, otherwise the ranks of a node are only made consecutive along X.
+ *
+ * @param nodes Node of each rank.
+ * @param comm_size Number of ranks.
+ * @param rank Rank to place.
+ * @param nb_x Number of ranks along X.
+ * @param nb_y Number of ranks along Y.
+ * @param width Width of the mesh.
+ * @param height Height of the mesh.
+ * @return Index of the rank in the grid.
+ **/
+static int lbm_comm_node_position(int const* nodes, int comm_size, int rank,
+                                  int nb_x, int nb_y, uint32_t width,
+                                  uint32_t height)
+{
+    int* node_sizes = calloc(comm_size, sizeof(int));
+    if (node_sizes == NULL) {
+        perror("malloc");
+        abort();
+    }
+    int position = 0;
+    for (int i = 0; i < comm_size; i++) {
+        node_sizes[nodes[i]]++;
+        if (nodes[i] < nodes[rank] || (nodes[i] == nodes[rank] && i < rank)) {
+            position++;
+        }
+    }
+    int const node_size = node_sizes[nodes[rank]];
+    bool uniform = true;
+    for (int i = 0; i < comm_size; i++) {
+        uniform &= (node_sizes[i] == 0 || node_sizes[i] == node_size);
+    }
+    free(node_sizes);
+
+    int tile_x, tile_y;
+    if (!uniform || !lbm_comm_choose_tile(node_size, nb_x, nb_y, width,
+                                          height, &tile_x, &tile_y)) {
+        return position;
+    }
+    int const tile = position / node_size;
+    int const offset = position % node_size;
+    int const tiles_x = nb_x / tile_x;
+    int const rank_x = (tile % tiles_x) * tile_x + offset % tile_x;
+    int const rank_y = (tile / tiles_x) * tile_y + offset / tile_x;
+    return rank_x + rank_y * nb_x;
+}
+
+/**
+ * @brief Sorts the halo bytes sent in one exchange between the neighbours on
+ * the same node and on other nodes, with the chosen placement and with the
+ * linear one (where the rank in `mesh_comm->world` is the position in the
+ * grid).
+ *
+ * @param mesh_comm Mesh communicator to update.
+ * @param nodes Node of each rank of `mesh_comm->world`.
+ **/
+static void lbm_comm_node_traffic(lbm_comm_t* mesh_comm, int const* nodes)
+{
+    int rank, world_rank;
+    MPI_Comm_rank(mesh_comm->comm, &rank);
+    MPI_Comm_rank(mesh_comm->world, &world_rank);
+    MPI_Group group, world_group;
+    MPI_Comm_group(mesh_comm->comm, &group);
+    MPI_Comm_group(mesh_comm->world, &world_group);
+
+    lbm_comm_neighbour_t neighbours[NB_NEIGHBOURS];
+    int const count = lbm_comm_neighbours(mesh_comm, neighbours);
+    for (int i = 0; i < count; i++) {
+        int world_neighbour, size;
+        MPI_Group_translate_ranks(group, 1, &neighbours[i].rank, world_group,
+                                  &world_neighbour);
+        MPI_Type_size(neighbours[i].send_type, &size);
+        mesh_comm->node_bytes[nodes[world_neighbour] != nodes[world_rank]] +=
+            size;
+        mesh_comm->linear_node_bytes[nodes[neighbours[i].rank] !=
+                                     nodes[rank]] += size;
+    }
+
+    MPI_Group_free(&group);
+    MPI_Group_free(&world_group);
 }
 
 /**
@@ -52,70 +451,344 @@ int helper_get_rank_id(int nb_x, int nb_y, int rank_x, int rank_y)
  * - size of the local mesh;
  * - relative position.
  *
+ * The ranks may be reordered according to `rank_placement`: the rank in
+ * `mesh_comm->comm` must then be used instead of the one in `world`.
+ *
  * @param mesh_comm Mesh communicator to initialize.
- * @param rank Rank asking the initialization.
+ * @param world Communicator of the compute ranks, kept by `mesh_comm`.
+ * @param rank Rank asking the initialization, in `world`.
  * @param comm_size Size of the communicator.
  * @param width Width of the mesh.
  * @param height Height of the mesh.
  **/
-void lbm_comm_init(lbm_comm_t* mesh_comm, int rank, int comm_size,
-                   uint32_t width, uint32_t height)
+void lbm_comm_init(lbm_comm_t* mesh_comm, MPI_Comm world, int rank,
+                   int comm_size, uint32_t width, uint32_t height)
 {
-    // Compute splitting
-    // int nb_y = lbm_helper_pgcd(comm_size, width);
-    // int nb_x = comm_size / nb_y;
-    int nb_x = lbm_helper_pgcd(comm_size, height);
-    int nb_y = comm_size / nb_x;
+    mesh_comm->world = world;
 
+    // Compute splitting
+    int nb_x = 1, nb_y = 1;
+    lbm_comm_choose_grid(comm_size, width, height, &nb_x, &nb_y);
     assert(nb_x * nb_y == comm_size);
-    if (height % nb_y != 0) {
-        fatal("Can't get a 2D cut for current problem size and number of "
-              "processes.");
+
+    // Grid of the ranks, rows first so that ranks are numbered along X
+    int const cart_dims[2] = { nb_y, nb_x };
+    int const periods[2] = { 0, 0 };
+    int* nodes = lbm_comm_world_nodes(world, comm_size);
+    mesh_comm->nb_nodes = 0;
+    for (int i = 0; i < comm_size; i++) {
+        mesh_comm->nb_nodes += (nodes[i] == i);
+    }
+    mesh_comm->placement = lbm_gbl_config.rank_placement;
+    if (mesh_comm->placement == PLACEMENT_NODE) {
+        // Ranks numbered by their position in the grid
+        MPI_Comm ordered;
+        MPI_Comm_split(world, 0,
+                       lbm_comm_node_position(nodes, comm_size, rank, nb_x,
+                                              nb_y, width, height),
+                       &ordered);
+        MPI_Cart_create(ordered, 2, cart_dims, periods, 0, &mesh_comm->comm);
+        MPI_Comm_free(&ordered);
+    } else {
+        MPI_Cart_create(world, 2, cart_dims, periods,
+                        mesh_comm->placement == PLACEMENT_CART,
+                        &mesh_comm->comm);
     }
+    MPI_Comm_rank(mesh_comm->comm, &rank);
 
     // Compute current rank position (ID)
-    int rank_x = rank % nb_x;
-    int rank_y = rank / nb_x;
+    int coords[2];
+    MPI_Cart_coords(mesh_comm->comm, rank, 2, coords);
+    int rank_x = coords[1];
+    int rank_y = coords[0];
 
     // Setup nb
     mesh_comm->nb_x = nb_x;
     mesh_comm->nb_y = nb_y;
+    mesh_comm->total_width = width;
+    mesh_comm->total_height = height;
 
-    // Setup size (+2 for ghost cells on border)
-    mesh_comm->width = width / nb_x + 2;
-    mesh_comm->height = height / nb_y + 2;
+    // Ghost layers may only come from direct neighbours
+    mesh_comm->ghost = lbm_gbl_config.halo_depth;
+    if (width / nb_x < mesh_comm->ghost || height / nb_y < mesh_comm->ghost) {
+        fatal("Local meshes are thinner than the halo depth.");
+    }
+    if (mesh_comm->ghost > 1 && lbm_gbl_config.halo_backend == HALO_SHARED) {
+        fatal("Deep halos are not supported by the shared-memory backend.");
+    }
 
-    // Setup position
-    mesh_comm->x = rank_x * width / nb_x;
-    mesh_comm->y = rank_y * height / nb_y;
+    // Setup position and size (+2 ghost layers for the borders), the
+    // remainders of the divisions are spread over the ranks
+    mesh_comm->x_bounds = malloc((nb_x + 1) * sizeof(uint32_t));
+    if (mesh_comm->x_bounds == NULL) {
+        perror("malloc");
+        abort();
+    }
+    for (int i = 0; i <= nb_x; i++) {
+        mesh_comm->x_bounds[i] = lbm_comm_split(width, nb_x, i);
+    }
+    lbm_comm_rank_area(mesh_comm, rank, &mesh_comm->x, &mesh_comm->y,
+                       &mesh_comm->width, &mesh_comm->height);
 
     // Compute neighbour nodes id
-    mesh_comm->left_id = helper_get_rank_id(nb_x, nb_y, rank_x - 1, rank_y);
-    mesh_comm->right_id = helper_get_rank_id(nb_x, nb_y, rank_x + 1, rank_y);
-    mesh_comm->top_id = helper_get_rank_id(nb_x, nb_y, rank_x, rank_y - 1);
-    mesh_comm->bottom_id = helper_get_rank_id(nb_x, nb_y, rank_x, rank_y + 1);
+    MPI_Comm const comm = mesh_comm->comm;
+    mesh_comm->left_id = helper_get_neighbour_id(comm, 1, -1);
+    mesh_comm->right_id = helper_get_neighbour_id(comm, 1, 1);
+    mesh_comm->top_id = helper_get_neighbour_id(comm, 0, -1);
+    mesh_comm->bottom_id = helper_get_neighbour_id(comm, 0, 1);
     mesh_comm->corner_id[CORNER_TOP_LEFT] =
-        helper_get_rank_id(nb_x, nb_y, rank_x - 1, rank_y - 1);
+        helper_get_rank_id(comm, nb_x, nb_y, rank_x - 1, rank_y - 1);
     mesh_comm->corner_id[CORNER_TOP_RIGHT] =
-        helper_get_rank_id(nb_x, nb_y, rank_x + 1, rank_y - 1);
+        helper_get_rank_id(comm, nb_x, nb_y, rank_x + 1, rank_y - 1);
     mesh_comm->corner_id[CORNER_BOTTOM_LEFT] =
-        helper_get_rank_id(nb_x, nb_y, rank_x - 1, rank_y + 1);
+        helper_get_rank_id(comm, nb_x, nb_y, rank_x - 1, rank_y + 1);
     mesh_comm->corner_id[CORNER_BOTTOM_RIGHT] =
-        helper_get_rank_id(nb_x, nb_y, rank_x + 1, rank_y + 1);
+        helper_get_rank_id(comm, nb_x, nb_y, rank_x + 1, rank_y + 1);
 
-    // If more than 1 on y, need transmission buffer
-    if (nb_y > 1) {
-        mesh_comm->buffer = malloc(sizeof(double) * DIRECTIONS * width / nb_x);
-    } else {
-        mesh_comm->buffer = NULL;
+    // No pending communication
+    mesh_comm->nb_requests = 0;
+    mesh_comm->messages_sent = 0;
+    mesh_comm->bytes_sent = 0;
+    mesh_comm->wait_time = 0.0;
+
+    // Only the populations crossing a side or a corner are exchanged
+    uint32_t const ghost = mesh_comm->ghost;
+    mesh_comm->side_types[SIDE_LEFT] =
+        lbm_comm_column_type(mesh_comm->height, ghost, -1);
+    mesh_comm->side_types[SIDE_RIGHT] =
+        lbm_comm_column_type(mesh_comm->height, ghost, 1);
+    mesh_comm->side_types[SIDE_TOP] =
+        lbm_comm_row_type(mesh_comm->width, mesh_comm->height, ghost, -1);
+    mesh_comm->side_types[SIDE_BOTTOM] =
+        lbm_comm_row_type(mesh_comm->width, mesh_comm->height, ghost, 1);
+    mesh_comm->corner_types[CORNER_TOP_LEFT] =
+        lbm_comm_corner_type(mesh_comm->height, ghost, -1, -1);
+    mesh_comm->corner_types[CORNER_TOP_RIGHT] =
+        lbm_comm_corner_type(mesh_comm->height, ghost, 1, -1);
+    mesh_comm->corner_types[CORNER_BOTTOM_LEFT] =
+        lbm_comm_corner_type(mesh_comm->height, ghost, -1, 1);
+    mesh_comm->corner_types[CORNER_BOTTOM_RIGHT] =
+        lbm_comm_corner_type(mesh_comm->height, ghost, 1, 1);
+
+    // Reduced-precision messages are staged outside of the mesh
+    mesh_comm->precision = lbm_gbl_config.halo_precision;
+    if (mesh_comm->precision != HALO_DOUBLE &&
+        lbm_gbl_config.halo_backend != HALO_P2P) {
+        fatal("Reduced-precision halos require the p2p halo backend.");
+    }
+    mesh_comm->packed.buffer = NULL;
+    mesh_comm->packed.capacity = 0;
+    mesh_comm->packed.used = 0;
+    mesh_comm->packed.nb_recvs = 0;
+
+    // Persistent requests are set up on the first exchange
+    mesh_comm->persistent.cells = NULL;
+    mesh_comm->persistent.nb_requests = 0;
+
+    // Ranks which may share their exchanged mesh
+    mesh_comm->node_comm = MPI_COMM_NULL;
+    mesh_comm->window = MPI_WIN_NULL;
+    mesh_comm->flags = NULL;
+    mesh_comm->nb_peers = 0;
+    mesh_comm->nb_exchanges = 0;
+    mesh_comm->bytes_copied = 0;
+    if (lbm_gbl_config.halo_backend == HALO_SHARED) {
+        MPI_Comm_split_type(mesh_comm->comm, MPI_COMM_TYPE_SHARED, rank,
+                            MPI_INFO_NULL, &mesh_comm->node_comm);
+    }
+
+    // Graph of the neighbours for the neighbourhood collectives, sources and
+    // destinations are the same ranks in the same order, weighted by the
+    // number of bytes exchanged
+    mesh_comm->backend = lbm_gbl_config.halo_backend;
+    mesh_comm->graph_comm = MPI_COMM_NULL;
+    if (mesh_comm->backend == HALO_NEIGHBOR) {
+        lbm_comm_neighbour_t neighbours[NB_NEIGHBOURS];
+        int const count = lbm_comm_neighbours(mesh_comm, neighbours);
+        int ranks[NB_NEIGHBOURS];
+        int weights[NB_NEIGHBOURS];
+        for (int i = 0; i < count; i++) {
+            ranks[i] = neighbours[i].rank;
+            MPI_Type_size(neighbours[i].send_type, &weights[i]);
+        }
+        MPI_Dist_graph_create_adjacent(mesh_comm->comm, count, ranks, weights,
+                                       count, ranks, weights, MPI_INFO_NULL, 0,
+                                       &mesh_comm->graph_comm);
     }
 
+    // Halo traffic within and between nodes
+    mesh_comm->node_bytes[0] = mesh_comm->node_bytes[1] = 0;
+    mesh_comm->linear_node_bytes[0] = mesh_comm->linear_node_bytes[1] = 0;
+    lbm_comm_node_traffic(mesh_comm, nodes);
+    free(nodes);
+
 // If debug print comm
 #ifndef NDEBUG
     lbm_comm_print(mesh_comm);
 #endif
 }
 
+/**
+ * @brief Frees the persistent requests of the halo exchange, they are set up
+ * again on the next exchange.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ **/
+static void lbm_comm_persistent_free(lbm_comm_t* mesh_comm)
+{
+    lbm_comm_persistent_t* persistent = &mesh_comm->persistent;
+    for (int i = 0; i < persistent->nb_requests; i++) {
+        MPI_Request_free(&persistent->requests[i]);
+    }
+    persistent->cells = NULL;
+    persistent->nb_requests = 0;
+}
+
+void lbm_comm_update_area(lbm_comm_t* mesh_comm)
+{
+    int rank;
+    MPI_Comm_rank(mesh_comm->comm, &rank);
+    lbm_comm_rank_area(mesh_comm, rank, &mesh_comm->x, &mesh_comm->y,
+                       &mesh_comm->width, &mesh_comm->height);
+
+    // Persistent requests refer to the reallocated mesh and the row types
+    lbm_comm_persistent_free(mesh_comm);
+
+    // Only the rows depend on the width
+    MPI_Type_free(&mesh_comm->side_types[SIDE_TOP]);
+    MPI_Type_free(&mesh_comm->side_types[SIDE_BOTTOM]);
+    mesh_comm->side_types[SIDE_TOP] = lbm_comm_row_type(
+        mesh_comm->width, mesh_comm->height, mesh_comm->ghost, -1);
+    mesh_comm->side_types[SIDE_BOTTOM] = lbm_comm_row_type(
+        mesh_comm->width, mesh_comm->height, mesh_comm->ghost, 1);
+}
+
+/**
+ * @brief Binds the neighbours on the same node to the local mesh: their
+ * boundary cells are read directly from the shared window instead of being
+ * sent.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh Exchanged mesh, allocated in the window.
+ **/
+static void lbm_comm_bind_peers(lbm_comm_t* mesh_comm, Mesh const* mesh)
+{
+    uint32_t const last_x = mesh->width - 1;
+    uint32_t const last_y = mesh->height - 1;
+    uint32_t const col = mesh->height * DIRECTIONS;
+
+    // Cells read in the neighbour are given from its far side (`-1` for its
+    // last inner column or row)
+    struct {
+        int rank;
+        int src_x;
+        int src_y;
+        uint32_t dst_x;
+        uint32_t dst_y;
+        uint32_t count;
+        bool row;
+    } const all[NB_NEIGHBOURS] = {
+        { mesh_comm->left_id, -1, 1, 0, 1, last_y - 1, false },
+        { mesh_comm->right_id, 1, 1, last_x, 1, last_y - 1, false },
+        { mesh_comm->top_id, 1, -1, 1, 0, last_x - 1, true },
+        { mesh_comm->bottom_id, 1, 1, 1, last_y, last_x - 1, true },
+        { mesh_comm->corner_id[CORNER_TOP_LEFT], -1, -1, 0, 0, 1, false },
+        { mesh_comm->corner_id[CORNER_TOP_RIGHT], 1, -1, last_x, 0, 1, false },
+        { mesh_comm->corner_id[CORNER_BOTTOM_LEFT], -1, 1, 0, last_y, 1,
+          false },
+        { mesh_comm->corner_id[CORNER_BOTTOM_RIGHT], 1, 1, last_x, last_y, 1,
+          false },
+    };
+
+    MPI_Group group, node_group;
+    MPI_Comm_group(mesh_comm->comm, &group);
+    MPI_Comm_group(mesh_comm->node_comm, &node_group);
+
+    mesh_comm->nb_peers = 0;
+    for (int i = 0; i < NB_NEIGHBOURS; i++) {
+        if (all[i].rank == -1) {
+            continue;
+        }
+        int node_rank;
+        MPI_Group_translate_ranks(group, 1, &all[i].rank, node_group,
+                                  &node_rank);
+        if (node_rank == MPI_UNDEFINED) {
+            continue;
+        }
+
+        // Segment of the neighbour: counters then cells
+        MPI_Aint size;
+        int disp_unit;
+        char* base;
+        MPI_Win_shared_query(mesh_comm->window, node_rank, &size, &disp_unit,
+                             &base);
+        uint32_t x, y, width, height;
+        lbm_comm_rank_area(mesh_comm, all[i].rank, &x, &y, &width, &height);
+        uint32_t const src_x = (all[i].src_x < 0) ? width - 2 : 1;
+        uint32_t const src_y = (all[i].src_y < 0) ? height - 2 : 1;
+        double const* cells = (double const*)(base + sizeof(lbm_comm_flags_t));
+
+        lbm_comm_peer_t* peer = &mesh_comm->peers[mesh_comm->nb_peers++];
+        peer->rank = all[i].rank;
+        peer->flags = (lbm_comm_flags_t*)base;
+        peer->src = &cells[(src_x * height + src_y) * DIRECTIONS];
+        peer->dst_x = all[i].dst_x;
+        peer->dst_y = all[i].dst_y;
+        peer->count = all[i].count;
+        peer->src_stride = all[i].row ? height * DIRECTIONS : DIRECTIONS;
+        peer->dst_stride = all[i].row ? col : DIRECTIONS;
+    }
+
+    MPI_Group_free(&group);
+    MPI_Group_free(&node_group);
+}
+
+void lbm_comm_mesh_init(lbm_comm_t* mesh_comm, Mesh* mesh)
+{
+    if (mesh_comm->backend != HALO_SHARED) {
+        Mesh_init(mesh, lbm_comm_width(mesh_comm), lbm_comm_height(mesh_comm));
+        return;
+    }
+
+    // Non contiguous segments, so that each one is local to its rank
+    mesh->width = lbm_comm_width(mesh_comm);
+    mesh->height = lbm_comm_height(mesh_comm);
+    MPI_Aint const size = sizeof(lbm_comm_flags_t) +
+                          (MPI_Aint)mesh->width * mesh->height * DIRECTIONS *
+                              sizeof(double);
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    char* base;
+    MPI_Win_allocate_shared(size, 1, info, mesh_comm->node_comm, &base,
+                            &mesh_comm->window);
+    MPI_Info_free(&info);
+
+    mesh_comm->flags = (lbm_comm_flags_t*)base;
+    atomic_init(&mesh_comm->flags->published, 0);
+    atomic_init(&mesh_comm->flags->consumed, 0);
+    mesh->cells = (double*)(base + sizeof(lbm_comm_flags_t));
+
+    // Counters must be initialized before the neighbours read them
+    MPI_Barrier(mesh_comm->node_comm);
+    lbm_comm_bind_peers(mesh_comm, mesh);
+}
+
+void lbm_comm_mesh_release(lbm_comm_t* mesh_comm, Mesh* mesh)
+{
+    if (mesh_comm->window == MPI_WIN_NULL) {
+        Mesh_release(mesh);
+        return;
+    }
+
+    mesh->width = 0;
+    mesh->height = 0;
+    mesh->cells = NULL;
+    mesh_comm->flags = NULL;
+    mesh_comm->nb_peers = 0;
+    MPI_Win_free(&mesh_comm->window);
+}
+
 /**
  * @brief Frees the memory of a `lbm_comm`.
  *
@@ -129,237 +802,617 @@ void lbm_comm_release(lbm_comm_t* mesh_comm)
     mesh_comm->height = 0;
     mesh_comm->right_id = -1;
     mesh_comm->left_id = -1;
-    if (mesh_comm->buffer != NULL) {
-        free(mesh_comm->buffer);
+    for (int i = 0; i < 4; i++) {
+        MPI_Type_free(&mesh_comm->side_types[i]);
+        MPI_Type_free(&mesh_comm->corner_types[i]);
     }
+    lbm_comm_persistent_free(mesh_comm);
+    free(mesh_comm->packed.buffer);
+    if (mesh_comm->node_comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&mesh_comm->node_comm);
+    }
+    if (mesh_comm->graph_comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&mesh_comm->graph_comm);
+    }
+    MPI_Comm_free(&mesh_comm->comm);
+    free(mesh_comm->x_bounds);
 }
 
 /**
- * @brief Start of the horizontal asynchronous communications.
+ * @brief Cells and populations of a halo message: the cells of a column, row
+ * or corner region, restricted to the populations travelling in the
+ * direction of the message.
  *
  * @param mesh_comm Mesh communicator to use.
- * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ * @param tag Direction of travel of the populations (side or 4 + corner).
+ * @param cols Number of columns of the region.
+ * @param rows Number of rows of the region.
+ * @param directions Filled with the exchanged populations.
+ * @return Number of exchanged populations per cell.
+ **/
+static int lbm_comm_packed_region(lbm_comm_t const* mesh_comm, int tag,
+                                  uint32_t* cols, uint32_t* rows,
+                                  int directions[DIRECTIONS])
+{
+    static int const dx[NB_NEIGHBOURS] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+    static int const dy[NB_NEIGHBOURS] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+    uint32_t const ghost = mesh_comm->ghost;
+    *cols = (dx[tag] == 0) ? mesh_comm->width - 2 * ghost : ghost;
+    *rows = (dy[tag] == 0) ? mesh_comm->height - 2 * ghost : ghost;
+
+    // Deep halos exchange whole cells
+    if (ghost > 1) {
+        for (int k = 0; k < DIRECTIONS; k++) {
+            directions[k] = k;
+        }
+        return DIRECTIONS;
+    }
+    return lbm_comm_crossing_directions(dx[tag], dy[tag], directions);
+}
+
+/**
+ * @brief Size of a reduced-precision halo message.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param tag Direction of travel of the populations.
+ * @return Size in bytes.
+ **/
+static size_t lbm_comm_packed_size(lbm_comm_t const* mesh_comm, int tag)
+{
+    uint32_t cols, rows;
+    int directions[DIRECTIONS];
+    int const count =
+        lbm_comm_packed_region(mesh_comm, tag, &cols, &rows, directions);
+    size_t const value_size =
+        (mesh_comm->precision == HALO_FLOAT) ? sizeof(float) : sizeof(_Float16);
+    return (size_t)cols * rows * count * value_size;
+}
+
+/**
+ * @brief Makes room for the reduced-precision messages of a whole exchange,
+ * before any of them is posted (the local mesh may have been resized).
+ *
+ * @param mesh_comm Mesh communicator to use.
+ **/
+static void lbm_comm_packed_reserve(lbm_comm_t* mesh_comm)
+{
+    lbm_comm_packed_t* packed = &mesh_comm->packed;
+    assert(packed->used == 0 && packed->nb_recvs == 0);
+
+    // One message sent and one received per direction at most
+    size_t capacity = 0;
+    for (int tag = 0; tag < NB_NEIGHBOURS; tag++) {
+        capacity += 2 * lbm_comm_packed_size(mesh_comm, tag);
+    }
+    if (capacity > packed->capacity) {
+        free(packed->buffer);
+        packed->buffer = malloc(capacity);
+        if (packed->buffer == NULL) {
+            perror("malloc");
+            abort();
+        }
+        packed->capacity = capacity;
+    }
+}
+
+/**
+ * @brief Narrows the populations of a halo message to their difference to the
+ * equilibrium weights, which keeps most of the significant bits.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param cell First cell of the message.
+ * @param tag Direction of travel of the populations.
+ * @param data Message to fill.
+ **/
+static void lbm_comm_pack(lbm_comm_t const* mesh_comm, double const* cell,
+                          int tag, char* data)
+{
+    uint32_t cols, rows;
+    int directions[DIRECTIONS];
+    int const count =
+        lbm_comm_packed_region(mesh_comm, tag, &cols, &rows, directions);
+    float* floats = (float*)data;
+    _Float16* halves = (_Float16*)data;
+
+    size_t n = 0;
+    for (uint32_t i = 0; i < cols; i++) {
+        for (uint32_t j = 0; j < rows; j++) {
+            double const* populations =
+                &cell[((size_t)i * mesh_comm->height + j) * DIRECTIONS];
+            for (int k = 0; k < count; k++, n++) {
+                int const d = directions[k];
+                double const delta = populations[d] - equil_weight[d];
+                if (mesh_comm->precision == HALO_FLOAT) {
+                    floats[n] = (float)delta;
+                } else {
+                    halves[n] = (_Float16)delta;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Widens a received reduced-precision halo message into the ghost
+ * cells.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param cell First ghost cell of the message.
+ * @param tag Direction of travel of the populations.
+ * @param data Received message.
+ **/
+static void lbm_comm_unpack(lbm_comm_t const* mesh_comm, double* cell,
+                            int tag, char const* data)
+{
+    uint32_t cols, rows;
+    int directions[DIRECTIONS];
+    int const count =
+        lbm_comm_packed_region(mesh_comm, tag, &cols, &rows, directions);
+    float const* floats = (float const*)data;
+    _Float16 const* halves = (_Float16 const*)data;
+
+    size_t n = 0;
+    for (uint32_t i = 0; i < cols; i++) {
+        for (uint32_t j = 0; j < rows; j++) {
+            double* populations =
+                &cell[((size_t)i * mesh_comm->height + j) * DIRECTIONS];
+            for (int k = 0; k < count; k++, n++) {
+                int const d = directions[k];
+                double const delta = (mesh_comm->precision == HALO_FLOAT)
+                                         ? (double)floats[n]
+                                         : (double)halves[n];
+                populations[d] = equil_weight[d] + delta;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Posts one non-blocking halo message. The request is stored in the
+ * communicator and completed by `lbm_comm_sync_ghosts_wait`.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param cell First cell of the message.
+ * @param type Datatype of the message.
+ * @param comm_type Whether to send or receive.
  * @param target_rank Rank to communicate with.
- * @param x X coordinate to use.
+ * @param tag Direction of travel of the populations, to tell the messages
+ * exchanged with the same rank apart.
  **/
-void lbm_comm_sync_ghosts_horizontal(Mesh* mesh_to_process,
-                                     lbm_comm_type_t comm_type, int target_rank,
-                                     uint32_t x)
+static void lbm_comm_post(lbm_comm_t* mesh, lbm_mesh_cell_t cell,
+                          MPI_Datatype type, lbm_comm_type_t comm_type,
+                          int target_rank, int tag)
 {
     // If target is -1, no comm
     if (target_rank == -1) {
         return;
     }
+    // Neighbours on the same node are read directly
+    for (int i = 0; i < mesh->nb_peers; i++) {
+        if (mesh->peers[i].rank == target_rank) {
+            return;
+        }
+    }
 
-    MPI_Status status;
+    // The persistent backend only posts messages to set its requests up
+    bool const persistent = mesh->backend == HALO_PERSISTENT;
+    MPI_Request* request;
+    if (persistent) {
+        assert(mesh->persistent.nb_requests < 32);
+        request = &mesh->persistent.requests[mesh->persistent.nb_requests++];
+    } else {
+        assert(mesh->nb_requests < 32);
+        request = &mesh->requests[mesh->nb_requests++];
+    }
+
+    // Reduced-precision messages are sent as bytes from the staging area
+    void* buffer = cell;
+    int count = 1;
+    if (mesh->precision != HALO_DOUBLE) {
+        lbm_comm_packed_t* packed = &mesh->packed;
+        size_t const size = lbm_comm_packed_size(mesh, tag);
+        assert(packed->used + size <= packed->capacity);
+        buffer = &packed->buffer[packed->used];
+        packed->used += size;
+        count = size;
+        type = MPI_BYTE;
+        if (comm_type == COMM_SEND) {
+            lbm_comm_pack(mesh, cell, tag, buffer);
+        } else {
+            packed->recv_cells[packed->nb_recvs] = cell;
+            packed->recv_tags[packed->nb_recvs] = tag;
+            packed->recv_data[packed->nb_recvs] = buffer;
+            packed->nb_recvs++;
+        }
+    }
+
+    int size;
     switch (comm_type) {
         case COMM_SEND:
-            MPI_Send(Mesh_get_col(mesh_to_process, x),
-                     DIRECTIONS * (mesh_to_process->height - 2), MPI_DOUBLE,
-                     target_rank, 0, MPI_COMM_WORLD);
+            if (persistent) {
+                MPI_Send_init(buffer, count, type, target_rank, tag,
+                              mesh->comm, request);
+            } else {
+                MPI_Isend(buffer, count, type, target_rank, tag, mesh->comm,
+                          request);
+            }
+            MPI_Type_size(type, &size);
+            mesh->messages_sent++;
+            mesh->bytes_sent += (uint64_t)count * size;
             break;
         case COMM_RECV:
-            MPI_Recv(Mesh_get_col(mesh_to_process, x),
-                     DIRECTIONS * (mesh_to_process->height - 2), MPI_DOUBLE,
-                     target_rank, 0, MPI_COMM_WORLD, &status);
+            if (persistent) {
+                MPI_Recv_init(buffer, count, type, target_rank, tag,
+                              mesh->comm, request);
+            } else {
+                MPI_Irecv(buffer, count, type, target_rank, tag, mesh->comm,
+                          request);
+            }
             break;
         default:
             fatal("unknown type of communication");
     }
 }
 
+/**
+ * @brief Start of the horizontal asynchronous communications.
+ *
+ * Only the populations travelling towards `side` are exchanged.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ * @param target_rank Rank to communicate with.
+ * @param x X coordinate to use.
+ * @param side Side towards which the exchanged populations travel.
+ **/
+void lbm_comm_sync_ghosts_horizontal(lbm_comm_t* mesh, Mesh* mesh_to_process,
+                                     lbm_comm_type_t comm_type, int target_rank,
+                                     uint32_t x, lbm_side_t side)
+{
+    lbm_comm_post(mesh, Mesh_get_cell(mesh_to_process, x, mesh->ghost),
+                  mesh->side_types[side], comm_type, target_rank, side);
+}
+
 /**
  * @brief Start of the diagonal asynchronous communications.
  *
+ * Only the populations travelling towards `corner` are exchanged.
+ *
  * @param mesh_comm Mesh communicator to use.
  * @param mesh_to_process Mesh to use when exchanging phantom meshes.
  * @param target_rank Rank to communicate with.
  * @param x X coordinate to use.
  * @param y Y coordinate to use.
+ * @param corner Corner towards which the exchanged populations travel.
  **/
-void lbm_comm_sync_ghosts_diagonal(Mesh* mesh_to_process,
+void lbm_comm_sync_ghosts_diagonal(lbm_comm_t* mesh, Mesh* mesh_to_process,
                                    lbm_comm_type_t comm_type, int target_rank,
-                                   uint32_t x, uint32_t y)
+                                   uint32_t x, uint32_t y,
+                                   lbm_corner_pos_t corner)
 {
-    // If target is -1, no comm
-    if (target_rank == -1) {
-        return;
-    }
-
-    MPI_Status status;
-    switch (comm_type) {
-        case COMM_SEND:
-            MPI_Send(Mesh_get_cell(mesh_to_process, x, y), DIRECTIONS,
-                     MPI_DOUBLE, target_rank, 0, MPI_COMM_WORLD);
-            break;
-        case COMM_RECV:
-            MPI_Recv(Mesh_get_cell(mesh_to_process, x, y), DIRECTIONS,
-                     MPI_DOUBLE, target_rank, 0, MPI_COMM_WORLD, &status);
-            break;
-        default:
-            fatal("unknown type of communication");
-    }
+    lbm_comm_post(mesh, Mesh_get_cell(mesh_to_process, x, y),
+                  mesh->corner_types[corner], comm_type, target_rank,
+                  4 + corner);
 }
 
 /**
  * @brief Start of the vertical asynchronous communications.
  *
+ * Only the populations travelling towards `side` are exchanged. The inner
+ * cells of the row are described by a strided datatype, no copy is needed.
+ *
  * @param mesh_comm Mesh communicator to use.
  * @param mesh_to_process Mesh to use when exchanging phantom meshes.
  * @param target_rank Rank to communicate with.
  * @param y Y coordinate to use.
+ * @param side Side towards which the exchanged populations travel.
  **/
 void lbm_comm_sync_ghosts_vertical(lbm_comm_t* mesh, Mesh* mesh_to_process,
                                    lbm_comm_type_t comm_type, int target_rank,
-                                   uint32_t y)
+                                   uint32_t y, lbm_side_t side)
 {
-    // if target is -1, no comm
-    if (target_rank == -1) {
-        return;
+    lbm_comm_post(mesh, Mesh_get_cell(mesh_to_process, mesh->ghost, y),
+                  mesh->side_types[side], comm_type, target_rank, side);
+}
+
+/**
+ * @brief Posts the whole halo exchange as one non-blocking neighbourhood
+ * collective. The request is stored in the communicator and completed by
+ * `lbm_comm_sync_ghosts_wait`.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+static void lbm_comm_sync_ghosts_neighbor(lbm_comm_t* mesh,
+                                          Mesh* mesh_to_process)
+{
+    lbm_comm_neighbour_t neighbours[NB_NEIGHBOURS];
+    int const count = lbm_comm_neighbours(mesh, neighbours);
+
+    // Displacements are recomputed as the mesh may be reallocated
+    lbm_comm_alltoallw_t* args = &mesh->alltoallw;
+    char* const base = (char*)mesh_to_process->cells;
+    for (int i = 0; i < count; i++) {
+        lbm_comm_neighbour_t const* n = &neighbours[i];
+        args->counts[i] = 1;
+        args->send_displs[i] =
+            (char*)Mesh_get_cell(mesh_to_process, n->send_x, n->send_y) - base;
+        args->send_types[i] = n->send_type;
+        args->recv_displs[i] =
+            (char*)Mesh_get_cell(mesh_to_process, n->recv_x, n->recv_y) - base;
+        args->recv_types[i] = n->recv_type;
+
+        int size;
+        MPI_Type_size(n->send_type, &size);
+        mesh->messages_sent++;
+        mesh->bytes_sent += size;
     }
 
-    MPI_Status status;
-    switch (comm_type) {
-        case COMM_SEND:
-            //#pragma omp parallel for schedule(guided)
-            for (size_t x = 1; x < mesh_to_process->width - 2; x++) {
-                for (size_t k = 0; k < DIRECTIONS; k++) {
-                    mesh->buffer[(x - 1) * DIRECTIONS + k] =
-                        Mesh_get_cell(mesh_to_process, x, y)[k];
-                }
-            }
-            MPI_Send(mesh->buffer, DIRECTIONS * (mesh_to_process->width - 2),
-                     MPI_DOUBLE, target_rank, 0, MPI_COMM_WORLD);
-            break;
-        case COMM_RECV:
-            MPI_Recv(mesh->buffer, DIRECTIONS * (mesh_to_process->width - 2),
-                     MPI_DOUBLE, target_rank, 0, MPI_COMM_WORLD, &status);
-            //#pragma omp parallel for schedule(guided)
-            for (size_t x = 1; x < mesh_to_process->width - 2; x++) {
-                for (size_t k = 0; k < DIRECTIONS; k++) {
-                    Mesh_get_cell(mesh_to_process, x, y)[k] =
-                        mesh->buffer[(x - 1) * DIRECTIONS + k];
-                }
+    // Sent and received cells are disjoint parts of the same mesh
+    assert(mesh->nb_requests < 32);
+    MPI_Ineighbor_alltoallw(base, args->counts, args->send_displs,
+                            args->send_types, base, args->counts,
+                            args->recv_displs, args->recv_types,
+                            mesh->graph_comm,
+                            &mesh->requests[mesh->nb_requests++]);
+}
+
+/**
+ * @brief Posts all the receives and the column sends of the point-to-point
+ * exchange.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+static void lbm_comm_sync_ghosts_columns(lbm_comm_t* mesh,
+                                         Mesh* mesh_to_process)
+{
+    // First owned layer, first of the last `ghost` owned columns, and first
+    // ghost layer on the far sides
+    uint32_t const first = mesh->ghost;
+    uint32_t const send_x = mesh->width - 2 * mesh->ghost;
+    uint32_t const recv_x = mesh->width - mesh->ghost;
+    uint32_t const recv_y = mesh->height - mesh->ghost;
+
+    // Post the receives first so that messages land directly in place
+    lbm_comm_sync_ghosts_horizontal(mesh, mesh_to_process, COMM_RECV,
+                                    mesh->left_id, 0, SIDE_RIGHT);
+    lbm_comm_sync_ghosts_horizontal(mesh, mesh_to_process, COMM_RECV,
+                                    mesh->right_id, recv_x, SIDE_LEFT);
+    lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_RECV,
+                                  mesh->top_id, 0, SIDE_BOTTOM);
+    lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_RECV,
+                                  mesh->bottom_id, recv_y, SIDE_TOP);
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_RECV,
+                                  mesh->corner_id[CORNER_TOP_LEFT], 0, 0,
+                                  CORNER_BOTTOM_RIGHT);
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_RECV,
+                                  mesh->corner_id[CORNER_TOP_RIGHT], recv_x, 0,
+                                  CORNER_BOTTOM_LEFT);
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_RECV,
+                                  mesh->corner_id[CORNER_BOTTOM_LEFT], 0,
+                                  recv_y, CORNER_TOP_RIGHT);
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_RECV,
+                                  mesh->corner_id[CORNER_BOTTOM_RIGHT], recv_x,
+                                  recv_y, CORNER_TOP_LEFT);
+
+    // Left to right phase
+    lbm_comm_sync_ghosts_horizontal(mesh, mesh_to_process, COMM_SEND,
+                                    mesh->right_id, send_x, SIDE_RIGHT);
+    // Right to left phase
+    lbm_comm_sync_ghosts_horizontal(mesh, mesh_to_process, COMM_SEND,
+                                    mesh->left_id, first, SIDE_LEFT);
+}
+
+/**
+ * @brief Posts the row and corner sends of the point-to-point exchange, the
+ * matching receives being posted by `lbm_comm_sync_ghosts_start`.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+static void lbm_comm_sync_ghosts_rows(lbm_comm_t* mesh, Mesh* mesh_to_process)
+{
+    // First owned layer, and first of the last `ghost` owned layers
+    uint32_t const first = mesh->ghost;
+    uint32_t const send_x = mesh->width - 2 * mesh->ghost;
+    uint32_t const send_y = mesh->height - 2 * mesh->ghost;
+
+    // Top to bottom phase
+    lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_SEND,
+                                  mesh->bottom_id, send_y, SIDE_BOTTOM);
+    // Bottom to top phase
+    lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_SEND,
+                                  mesh->top_id, first, SIDE_TOP);
+
+    // Corner phases
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_SEND,
+                                  mesh->corner_id[CORNER_TOP_LEFT], first,
+                                  first, CORNER_TOP_LEFT);
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_SEND,
+                                  mesh->corner_id[CORNER_TOP_RIGHT],
+                                  send_x, first, CORNER_TOP_RIGHT);
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_SEND,
+                                  mesh->corner_id[CORNER_BOTTOM_LEFT],
+                                  first, send_y, CORNER_BOTTOM_LEFT);
+    lbm_comm_sync_ghosts_diagonal(mesh, mesh_to_process, COMM_SEND,
+                                  mesh->corner_id[CORNER_BOTTOM_RIGHT],
+                                  send_x, send_y, CORNER_BOTTOM_RIGHT);
+}
+
+/**
+ * @brief Sets the persistent requests of the point-to-point exchange up on
+ * the cells of `mesh_to_process`, in place of the previous ones.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+static void lbm_comm_persistent_setup(lbm_comm_t* mesh, Mesh* mesh_to_process)
+{
+    lbm_comm_persistent_t* persistent = &mesh->persistent;
+    lbm_comm_persistent_free(mesh);
+
+    // Messages are only counted when started, restore the counters after
+    uint64_t const messages_sent = mesh->messages_sent;
+    uint64_t const bytes_sent = mesh->bytes_sent;
+
+    lbm_comm_sync_ghosts_columns(mesh, mesh_to_process);
+    persistent->nb_start = persistent->nb_requests;
+    persistent->messages_sent[0] = mesh->messages_sent - messages_sent;
+    persistent->bytes_sent[0] = mesh->bytes_sent - bytes_sent;
+
+    lbm_comm_sync_ghosts_rows(mesh, mesh_to_process);
+    persistent->messages_sent[1] =
+        mesh->messages_sent - messages_sent - persistent->messages_sent[0];
+    persistent->bytes_sent[1] =
+        mesh->bytes_sent - bytes_sent - persistent->bytes_sent[0];
+
+    mesh->messages_sent = messages_sent;
+    mesh->bytes_sent = bytes_sent;
+    persistent->cells = mesh_to_process->cells;
+}
+
+/**
+ * @brief Starts one phase of the persistent requests.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param phase 0 for the receives and columns, 1 for the rows and corners.
+ **/
+static void lbm_comm_persistent_start(lbm_comm_t* mesh, int phase)
+{
+    lbm_comm_persistent_t* persistent = &mesh->persistent;
+    int const first = (phase == 0) ? 0 : persistent->nb_start;
+    int const last =
+        (phase == 0) ? persistent->nb_start : persistent->nb_requests;
+
+    MPI_Startall(last - first, &persistent->requests[first]);
+    mesh->messages_sent += persistent->messages_sent[phase];
+    mesh->bytes_sent += persistent->bytes_sent[phase];
+}
+
+/**
+ * @brief Tells the neighbours on the same node that the boundary cells of the
+ * current exchange are collided.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ **/
+static void lbm_comm_shared_publish(lbm_comm_t* mesh)
+{
+    atomic_store_explicit(&mesh->flags->published, mesh->nb_exchanges + 1,
+                          memory_order_release);
+}
+
+/**
+ * @brief Copies the ghost cells from the meshes of the neighbours on the same
+ * node, then waits until they are done reading the local mesh, which can then
+ * be modified again.
+ *
+ * @param mesh_comm Mesh communicator to use.
+ * @param mesh_to_process Mesh to use when exchanging phantom meshes.
+ **/
+static void lbm_comm_shared_copy(lbm_comm_t* mesh, Mesh* mesh_to_process)
+{
+    uint32_t const exchange = mesh->nb_exchanges + 1;
+
+    for (int i = 0; i < mesh->nb_peers; i++) {
+        lbm_comm_peer_t const* peer = &mesh->peers[i];
+        lbm_spin_until(&peer->flags->published, exchange);
+
+        double* dst = Mesh_get_cell(mesh_to_process, peer->dst_x, peer->dst_y);
+        if (peer->src_stride == DIRECTIONS && peer->dst_stride == DIRECTIONS) {
+            // Columns are contiguous
+            memcpy(dst, peer->src, peer->count * DIRECTIONS * sizeof(double));
+        } else {
+            for (uint32_t k = 0; k < peer->count; k++) {
+                memcpy(&dst[k * peer->dst_stride],
+                       &peer->src[k * peer->src_stride],
+                       DIRECTIONS * sizeof(double));
             }
-            break;
-        default:
-            fatal("unknown type of communication");
+        }
+        mesh->bytes_copied += peer->count * DIRECTIONS * sizeof(double);
     }
+
+    atomic_store_explicit(&mesh->flags->consumed, exchange,
+                          memory_order_release);
+    for (int i = 0; i < mesh->nb_peers; i++) {
+        lbm_spin_until(&mesh->peers[i].flags->consumed, exchange);
+    }
+    mesh->nb_exchanges = exchange;
 }
 
-void lbm_comm_ghost_exchange(lbm_comm_t* mesh, Mesh* mesh_to_process)
+void lbm_comm_sync_ghosts_start(lbm_comm_t* mesh, Mesh* mesh_to_process)
 {
-    int rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-
-    if (rank % 2) {
-        // Left to right phase
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_SEND, mesh->right_id,
-                                        mesh->width - 2);
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_RECV, mesh->left_id,
-                                        0);
-
-        // Right to left phase
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_SEND, mesh->left_id,
-                                        1);
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_RECV, mesh->right_id,
-                                        mesh->width - 1);
-    } else {
-        // Left to right phase
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_RECV, mesh->left_id,
-                                        0);
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_SEND, mesh->right_id,
-                                        mesh->width - 2);
-
-        // Right to left phase
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_RECV, mesh->right_id,
-                                        mesh->width - 1);
-        lbm_comm_sync_ghosts_horizontal(mesh_to_process, COMM_SEND, mesh->left_id,
-                                        1);
-    }
-    // // Top to bottom phase
-    // lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_SEND,
-    //                               mesh->bottom_id, mesh->height - 2);
-    // lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_RECV,
-    //                               mesh->top_id, 0);
-
-    // // Bottom to top phase
-    // lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_SEND,
-    //                               mesh->top_id, 1);
-    // lbm_comm_sync_ghosts_vertical(mesh, mesh_to_process, COMM_RECV,
-    //                               mesh->bottom_id, mesh->height - 1);
-
-    // // Top left phase
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_SEND,
-    //                               mesh->corner_id[CORNER_TOP_LEFT], 1, 1);
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_RECV,
-    //                               mesh->corner_id[CORNER_BOTTOM_RIGHT],
-    //                               mesh->width - 1, mesh->height - 1);
-
-    // // Bottom left phase
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_SEND,
-    //                               mesh->corner_id[CORNER_BOTTOM_LEFT], 1,
-    //                               mesh->height - 2);
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_RECV,
-    //                               mesh->corner_id[CORNER_TOP_RIGHT],
-    //                               mesh->width - 1, 0);
-
-    // // Top right phase
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_SEND,
-    //                               mesh->corner_id[CORNER_TOP_RIGHT],
-    //                               mesh->width - 2, 1);
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_RECV,
-    //                               mesh->corner_id[CORNER_BOTTOM_LEFT], 0,
-    //                               mesh->height - 1);
-
-    // // Bottom left phase
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_SEND,
-    //                               mesh->corner_id[CORNER_BOTTOM_LEFT], 1,
-    //                               mesh->height - 2);
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_RECV,
-    //                               mesh->corner_id[CORNER_TOP_RIGHT],
-    //                               mesh->width - 1, 0);
-
-    // // Bottom right phase
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_SEND,
-    //                               mesh->corner_id[CORNER_BOTTOM_RIGHT],
-    //                               mesh->width - 2, mesh->height - 2);
-    // lbm_comm_sync_ghosts_diagonal(mesh_to_process, COMM_RECV,
-    //                               mesh->corner_id[CORNER_TOP_LEFT], 0, 0);
-}
-
-/**
- * Rendu du mesh en effectuant une réduction a 0
- * @param mesh_comm MeshComm à utiliser
- * @param temp Mesh a utiliser pour stocker les segments
- **/
-void save_frame_all_domain(FILE* fp, Mesh* source_mesh, Mesh* temp)
-{
-    int comm_size, rank;
-    MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-
-    // If we have more than one process
-    if (1 < comm_size) {
-        if (rank == RANK_MASTER) {
-            // Rank 0 renders its local Mesh
-            save_frame(fp, source_mesh);
-            // Rank 0 receives & render other processes meshes
-            for (ssize_t i = 1; i < comm_size; i++) {
-                MPI_Status status;
-                MPI_Recv(temp->cells,
-                         source_mesh->width * source_mesh->height * DIRECTIONS,
-                         MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &status);
-                save_frame(fp, temp);
-            }
-        } else {
-            // All other ranks send their local mesh
-            MPI_Send(source_mesh->cells,
-                     source_mesh->width * source_mesh->height * DIRECTIONS,
-                     MPI_DOUBLE, RANK_MASTER, 0, MPI_COMM_WORLD);
+    // A single collective: posted now unless rows must be sent too
+    if (mesh->backend == HALO_NEIGHBOR) {
+        if (!lbm_comm_exchanges_rows(mesh)) {
+            lbm_comm_sync_ghosts_neighbor(mesh, mesh_to_process);
         }
+        return;
+    }
+
+    // Requests are only set up again when the mesh moved
+    if (mesh->backend == HALO_PERSISTENT) {
+        if (mesh->persistent.cells != mesh_to_process->cells) {
+            lbm_comm_persistent_setup(mesh, mesh_to_process);
+        }
+        lbm_comm_persistent_start(mesh, 0);
+        return;
+    }
+
+    if (mesh->precision != HALO_DOUBLE) {
+        lbm_comm_packed_reserve(mesh);
+    }
+    lbm_comm_sync_ghosts_columns(mesh, mesh_to_process);
+    // Same as above for the neighbours on the same node
+    if (mesh->backend == HALO_SHARED && !lbm_comm_exchanges_rows(mesh)) {
+        lbm_comm_shared_publish(mesh);
+    }
+}
+
+void lbm_comm_sync_ghosts_wait(lbm_comm_t* mesh, Mesh* mesh_to_process)
+{
+    if (mesh->backend == HALO_NEIGHBOR) {
+        // The collective includes the rows, it is posted once they collided
+        if (lbm_comm_exchanges_rows(mesh)) {
+            lbm_comm_sync_ghosts_neighbor(mesh, mesh_to_process);
+        }
+    } else if (mesh->backend == HALO_PERSISTENT) {
+        lbm_comm_persistent_start(mesh, 1);
     } else {
-        // Only 0 renders its local mesh
-        save_frame(fp, source_mesh);
+        lbm_comm_sync_ghosts_rows(mesh, mesh_to_process);
+    }
+    if (mesh->backend == HALO_SHARED && lbm_comm_exchanges_rows(mesh)) {
+        lbm_comm_shared_publish(mesh);
+    }
+
+    // Persistent requests stay allocated, inactive, once completed
+    MPI_Request* requests = mesh->requests;
+    int nb_requests = mesh->nb_requests;
+    if (mesh->backend == HALO_PERSISTENT) {
+        requests = mesh->persistent.requests;
+        nb_requests = mesh->persistent.nb_requests;
+    }
+
+    double const before = MPI_Wtime();
+    if (mesh->backend == HALO_SHARED) {
+        lbm_comm_shared_copy(mesh, mesh_to_process);
     }
+    MPI_Waitall(nb_requests, requests, MPI_STATUSES_IGNORE);
+    mesh->wait_time += MPI_Wtime() - before;
+    mesh->nb_requests = 0;
+
+    // Reduced-precision messages are widened once received
+    lbm_comm_packed_t* packed = &mesh->packed;
+    for (int i = 0; i < packed->nb_recvs; i++) {
+        lbm_comm_unpack(mesh, packed->recv_cells[i], packed->recv_tags[i],
+                        packed->recv_data[i]);
+    }
+    packed->nb_recvs = 0;
+    packed->used = 0;
+}
+
+void lbm_comm_ghost_exchange(lbm_comm_t* mesh, Mesh* mesh_to_process)
+{
+    lbm_comm_sync_ghosts_start(mesh, mesh_to_process);
+    lbm_comm_sync_ghosts_wait(mesh, mesh_to_process);
 }
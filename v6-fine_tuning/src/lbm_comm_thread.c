@@ -0,0 +1,215 @@
+#include "lbm_comm_thread.h"
+
+#include "lbm_phys.h"
+
+#include <omp.h>
+#include <string.h>
+
+void lbm_comm_thread_init(lbm_comm_thread_t* comm_thread, int nb_threads,
+                          lbm_comm_t const* mesh_comm)
+{
+    if (nb_threads < 2) {
+        fatal("A communication thread requires at least 2 OpenMP threads.");
+    }
+
+    comm_thread->nb_workers = nb_threads - 1;
+    lbm_barrier_init(&comm_thread->workers, comm_thread->nb_workers);
+    atomic_init(&comm_thread->edges_done, 0);
+    atomic_init(&comm_thread->collide_done, 0);
+    atomic_init(&comm_thread->snapshot_done, 0);
+    atomic_init(&comm_thread->ghosts_done, 0);
+    comm_thread->frame_pending = false;
+    comm_thread->comm_time = 0.0;
+    comm_thread->exposed_time = 0.0;
+
+    Mesh_init(&comm_thread->snapshot, lbm_comm_width(mesh_comm),
+              lbm_comm_height(mesh_comm));
+}
+
+void lbm_comm_thread_release(lbm_comm_thread_t* comm_thread)
+{
+    Mesh_release(&comm_thread->snapshot);
+}
+
+void lbm_comm_thread_request_frame(lbm_comm_thread_t* comm_thread)
+{
+    comm_thread->frame_pending = true;
+}
+
+void lbm_comm_thread_flush_frame(lbm_comm_thread_t* comm_thread,
+                                 lbm_comm_t const* mesh_comm, Mesh* mesh,
+                                 lbm_output_t* output)
+{
+    if (comm_thread->frame_pending) {
+        lbm_output_write_frame(output, mesh_comm, mesh);
+        comm_thread->frame_pending = false;
+    }
+}
+
+/**
+ * @brief Work of the communication thread during one step.
+ **/
+static void lbm_comm_thread_communicate(lbm_comm_thread_t* comm_thread,
+                                        Mesh* temp, lbm_comm_t* mesh_comm,
+                                        lbm_output_t* output)
+{
+    double const before = omp_get_wtime();
+
+    // Save the previous step while the workers compute
+    if (comm_thread->frame_pending) {
+        lbm_spin_until(&comm_thread->snapshot_done, comm_thread->nb_workers);
+        lbm_output_write_frame(output, mesh_comm, &comm_thread->snapshot);
+    }
+
+    // Exchange as soon as the boundary columns are collided, rows and
+    // corners once every column is
+    uint32_t const nb_edges = (temp->width - 2 > 1) ? 2 : 1;
+    lbm_spin_until(&comm_thread->edges_done, nb_edges);
+    lbm_comm_sync_ghosts_start(mesh_comm, temp);
+    if (lbm_comm_exchanges_rows(mesh_comm)) {
+        lbm_spin_until(&comm_thread->collide_done, comm_thread->nb_workers);
+    }
+    lbm_comm_sync_ghosts_wait(mesh_comm, temp);
+    atomic_store_explicit(&comm_thread->ghosts_done, 1, memory_order_release);
+
+    comm_thread->comm_time += omp_get_wtime() - before;
+}
+
+/**
+ * @brief Special actions and collision of one column.
+ **/
+static inline void lbm_comm_thread_collide(Mesh* mesh, Mesh* temp,
+                                           lbm_mesh_type_t* mesh_type,
+                                           lbm_comm_t const* mesh_comm,
+                                           size_t i)
+{
+    special_cells_column(mesh, mesh_type, mesh_comm, i);
+    collision_column(temp, mesh, i);
+}
+
+/**
+ * @brief Waits for the ghost cells and returns the time spent waiting.
+ **/
+static double lbm_comm_thread_wait_ghosts(lbm_comm_thread_t* comm_thread)
+{
+    double const before = omp_get_wtime();
+    lbm_spin_until(&comm_thread->ghosts_done, 1);
+    return omp_get_wtime() - before;
+}
+
+/**
+ * @brief Work of a worker thread during one step.
+ **/
+static void lbm_comm_thread_compute(lbm_comm_thread_t* comm_thread,
+                                    uint32_t worker, Mesh* mesh, Mesh* temp,
+                                    lbm_mesh_type_t* mesh_type,
+                                    lbm_comm_t const* mesh_comm)
+{
+    // Static partition of the inner columns between the workers
+    size_t const inner_width = mesh->width - 2;
+    size_t const begin = 1 + worker * inner_width / comm_thread->nb_workers;
+    size_t const end =
+        1 + (worker + 1) * inner_width / comm_thread->nb_workers;
+    size_t const last = mesh->width - 2;
+    // Workers with no column when there are fewer columns than workers must
+    // not take the edges too
+    bool const has_left = (begin == 1 && begin < end);
+    bool const has_right = (end == last + 1 && begin < end);
+
+    // Snapshot the owned columns before modifying them
+    if (comm_thread->frame_pending) {
+        memcpy(Mesh_get_cell(&comm_thread->snapshot, begin, 0),
+               Mesh_get_cell(mesh, begin, 0),
+               (end - begin) * mesh->height * DIRECTIONS * sizeof(double));
+        atomic_fetch_add_explicit(&comm_thread->snapshot_done, 1,
+                                  memory_order_release);
+    }
+
+    // Boundary columns first so the exchange can start
+    if (has_left) {
+        lbm_comm_thread_collide(mesh, temp, mesh_type, mesh_comm, 1);
+        atomic_fetch_add_explicit(&comm_thread->edges_done, 1,
+                                  memory_order_release);
+    }
+    if (has_right && last != 1) {
+        lbm_comm_thread_collide(mesh, temp, mesh_type, mesh_comm, last);
+        atomic_fetch_add_explicit(&comm_thread->edges_done, 1,
+                                  memory_order_release);
+    }
+
+    // Inner columns while the communication thread exchanges
+    for (size_t i = begin; i < end; i++) {
+        if (i != 1 && i != last) {
+            lbm_comm_thread_collide(mesh, temp, mesh_type, mesh_comm, i);
+        }
+    }
+
+    atomic_fetch_add_explicit(&comm_thread->collide_done, 1,
+                              memory_order_release);
+
+    // Propagation writes in the neighbouring columns, and reads the ghost
+    // rows when they are exchanged
+    lbm_barrier_wait(&comm_thread->workers);
+    bool const rows = lbm_comm_exchanges_rows(mesh_comm);
+    double const wait_rows = rows ? lbm_comm_thread_wait_ghosts(comm_thread)
+                                  : 0.0;
+    for (size_t i = begin; i < end; i++) {
+        propagation_column(mesh, temp, i);
+    }
+
+    // Ghost columns last, once received
+    if (has_left) {
+        comm_thread->wait_left =
+            rows ? wait_rows : lbm_comm_thread_wait_ghosts(comm_thread);
+        propagation_column(mesh, temp, 0);
+    }
+    if (has_right) {
+        comm_thread->wait_right =
+            (has_left || rows) ? wait_rows
+                               : lbm_comm_thread_wait_ghosts(comm_thread);
+        propagation_column(mesh, temp, mesh->width - 1);
+    }
+}
+
+void lbm_comm_thread_step(lbm_comm_thread_t* comm_thread, Mesh* mesh,
+                          Mesh* temp, lbm_mesh_type_t* mesh_type,
+                          lbm_comm_t* mesh_comm, lbm_output_t* output)
+{
+    int const tid = omp_get_thread_num();
+
+    if (tid == COMM_THREAD_ID) {
+        lbm_comm_thread_communicate(comm_thread, temp, mesh_comm, output);
+    } else {
+        uint32_t const worker = (tid < COMM_THREAD_ID) ? tid : tid - 1;
+        lbm_comm_thread_compute(comm_thread, worker, mesh, temp, mesh_type,
+                                mesh_comm);
+    }
+
+    // Reset the step state once everyone is done
+    #pragma omp barrier
+    #pragma omp single
+    {
+        comm_thread->exposed_time += (comm_thread->wait_left >
+                                      comm_thread->wait_right)
+                                         ? comm_thread->wait_left
+                                         : comm_thread->wait_right;
+        comm_thread->frame_pending = false;
+        atomic_store_explicit(&comm_thread->edges_done, 0,
+                              memory_order_relaxed);
+        atomic_store_explicit(&comm_thread->collide_done, 0,
+                              memory_order_relaxed);
+        atomic_store_explicit(&comm_thread->snapshot_done, 0,
+                              memory_order_relaxed);
+        atomic_store_explicit(&comm_thread->ghosts_done, 0,
+                              memory_order_relaxed);
+    }
+}
+
+double lbm_comm_thread_overlap(lbm_comm_thread_t const* comm_thread)
+{
+    if (comm_thread->comm_time <= 0.0) {
+        return 0.0;
+    }
+    double const hidden = comm_thread->comm_time - comm_thread->exposed_time;
+    return (hidden > 0.0 ? hidden : 0.0) / comm_thread->comm_time * 100.0;
+}
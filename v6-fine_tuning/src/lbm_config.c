@@ -1,4 +1,7 @@
 #include "../include/lbm_config.h"
+#include "../include/lbm_comm.h"
+#include "../include/lbm_output.h"
+#include "../include/lbm_sched.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,6 +29,25 @@ void setup_default_values(void)
     // Result output file
     lbm_gbl_config.output_filename = NULL;
     lbm_gbl_config.write_interval = 50;
+    // Threading
+    lbm_gbl_config.thread_domains = 0;
+    lbm_gbl_config.blocks_per_rank = 0;
+    lbm_gbl_config.comm_thread = 0;
+    lbm_gbl_config.scheduler = SCHED_OMP;
+    lbm_gbl_config.sched_chunk = 8;
+    // Load balancing
+    lbm_gbl_config.balance_interval = 0;
+    // Communications
+    lbm_gbl_config.halo_backend = HALO_P2P;
+    lbm_gbl_config.halo_depth = 1;
+    lbm_gbl_config.halo_precision = HALO_DOUBLE;
+    lbm_gbl_config.rank_placement = PLACEMENT_LINEAR;
+    // Output
+    lbm_gbl_config.output_backend = OUTPUT_POSIX;
+    lbm_gbl_config.output_buffers = 0;
+    lbm_gbl_config.io_servers = 0;
+    lbm_gbl_config.output_compression = COMPRESSION_NONE;
+    lbm_gbl_config.output_error_bound = 1e-5;
 }
 
 /**
@@ -105,6 +127,120 @@ void load_config(const char* filename)
             lbm_gbl_config.relax_parameter = doubleValue;
         } else if (sscanf(buffer, "write_interval = %d\n", &intValue) == 1) {
             lbm_gbl_config.write_interval = intValue;
+        } else if (sscanf(buffer, "thread_domains = %d\n", &intValue) == 1) {
+            lbm_gbl_config.thread_domains = intValue;
+        } else if (sscanf(buffer, "blocks_per_rank = %d\n", &intValue) == 1) {
+            if (intValue < 0) {
+                fprintf(stderr, "Invalid blocks per rank line %d: %s\n", line, buffer);
+                abort();
+            }
+            lbm_gbl_config.blocks_per_rank = intValue;
+        } else if (sscanf(buffer, "comm_thread = %d\n", &intValue) == 1) {
+            lbm_gbl_config.comm_thread = intValue;
+        } else if (sscanf(buffer, "scheduler = %s\n", buffer2) == 1) {
+            if (strcmp(buffer2, "omp") == 0) {
+                lbm_gbl_config.scheduler = SCHED_OMP;
+            } else if (strcmp(buffer2, "static") == 0) {
+                lbm_gbl_config.scheduler = SCHED_STATIC;
+            } else if (strcmp(buffer2, "stealing") == 0) {
+                lbm_gbl_config.scheduler = SCHED_STEALING;
+            } else {
+                fprintf(stderr, "Invalid scheduler line %d: %s\n", line, buffer);
+                abort();
+            }
+        } else if (sscanf(buffer, "sched_chunk = %d\n", &intValue) == 1) {
+            if (intValue < 0) {
+                fprintf(stderr, "Invalid scheduler chunk line %d: %s\n", line, buffer);
+                abort();
+            }
+            lbm_gbl_config.sched_chunk = intValue;
+        } else if (sscanf(buffer, "balance_interval = %d\n", &intValue) == 1) {
+            if (intValue < 0) {
+                fprintf(stderr, "Invalid balance interval line %d: %s\n", line, buffer);
+                abort();
+            }
+            lbm_gbl_config.balance_interval = intValue;
+        } else if (sscanf(buffer, "halo_depth = %d\n", &intValue) == 1) {
+            if (intValue < 1) {
+                fprintf(stderr, "Invalid halo depth line %d: %s\n", line, buffer);
+                abort();
+            }
+            lbm_gbl_config.halo_depth = intValue;
+        } else if (sscanf(buffer, "halo_backend = %s\n", buffer2) == 1) {
+            if (strcmp(buffer2, "p2p") == 0) {
+                lbm_gbl_config.halo_backend = HALO_P2P;
+            } else if (strcmp(buffer2, "neighbor") == 0) {
+                lbm_gbl_config.halo_backend = HALO_NEIGHBOR;
+            } else if (strcmp(buffer2, "persistent") == 0) {
+                lbm_gbl_config.halo_backend = HALO_PERSISTENT;
+            } else if (strcmp(buffer2, "shared") == 0) {
+                lbm_gbl_config.halo_backend = HALO_SHARED;
+            } else {
+                fprintf(stderr, "Invalid halo backend line %d: %s\n", line, buffer);
+                abort();
+            }
+        } else if (sscanf(buffer, "halo_precision = %s\n", buffer2) == 1) {
+            if (strcmp(buffer2, "double") == 0) {
+                lbm_gbl_config.halo_precision = HALO_DOUBLE;
+            } else if (strcmp(buffer2, "float") == 0) {
+                lbm_gbl_config.halo_precision = HALO_FLOAT;
+            } else if (strcmp(buffer2, "half") == 0) {
+                lbm_gbl_config.halo_precision = HALO_HALF;
+            } else {
+                fprintf(stderr, "Invalid halo precision line %d: %s\n", line, buffer);
+                abort();
+            }
+        } else if (sscanf(buffer, "rank_placement = %s\n", buffer2) == 1) {
+            if (strcmp(buffer2, "linear") == 0) {
+                lbm_gbl_config.rank_placement = PLACEMENT_LINEAR;
+            } else if (strcmp(buffer2, "cart") == 0) {
+                lbm_gbl_config.rank_placement = PLACEMENT_CART;
+            } else if (strcmp(buffer2, "node") == 0) {
+                lbm_gbl_config.rank_placement = PLACEMENT_NODE;
+            } else {
+                fprintf(stderr, "Invalid rank placement line %d: %s\n", line, buffer);
+                abort();
+            }
+        } else if (sscanf(buffer, "output_backend = %s\n", buffer2) == 1) {
+            if (strcmp(buffer2, "posix") == 0) {
+                lbm_gbl_config.output_backend = OUTPUT_POSIX;
+            } else if (strcmp(buffer2, "mpiio") == 0) {
+                lbm_gbl_config.output_backend = OUTPUT_MPIIO;
+            } else if (strcmp(buffer2, "node") == 0) {
+                lbm_gbl_config.output_backend = OUTPUT_NODE;
+            } else {
+                fprintf(stderr, "Invalid output backend line %d: %s\n", line, buffer);
+                abort();
+            }
+        } else if (sscanf(buffer, "output_buffers = %d\n", &intValue) == 1) {
+            if (intValue < 0) {
+                fprintf(stderr, "Invalid output buffers line %d: %s\n", line, buffer);
+                abort();
+            }
+            lbm_gbl_config.output_buffers = intValue;
+        } else if (sscanf(buffer, "io_servers = %d\n", &intValue) == 1) {
+            if (intValue < 0) {
+                fprintf(stderr, "Invalid io servers line %d: %s\n", line, buffer);
+                abort();
+            }
+            lbm_gbl_config.io_servers = intValue;
+        } else if (sscanf(buffer, "output_compression = %s\n", buffer2) == 1) {
+            if (strcmp(buffer2, "none") == 0) {
+                lbm_gbl_config.output_compression = COMPRESSION_NONE;
+            } else if (strcmp(buffer2, "lossless") == 0) {
+                lbm_gbl_config.output_compression = COMPRESSION_LOSSLESS;
+            } else if (strcmp(buffer2, "lossy") == 0) {
+                lbm_gbl_config.output_compression = COMPRESSION_LOSSY;
+            } else {
+                fprintf(stderr, "Invalid output compression line %d: %s\n", line, buffer);
+                abort();
+            }
+        } else if (sscanf(buffer, "output_error_bound = %lf\n", &doubleValue) == 1) {
+            if (doubleValue <= 0.0) {
+                fprintf(stderr, "Invalid output error bound line %d: %s\n", line, buffer);
+                abort();
+            }
+            lbm_gbl_config.output_error_bound = doubleValue;
         } else if (sscanf(buffer, "output_filename = %s\n", buffer2) == 1) {
             lbm_gbl_config.output_filename = strdup(buffer2);
         } else {
@@ -146,6 +282,21 @@ void print_config(void)
            "%-20s = %lf\n"
            "%-20s = %s\n"
            "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %d\n"
+           "%-20s = %g\n"
            "------------ Derived parameters --------------\n"
            "%-20s = %lf\n"
            "%-20s = %lf\n"
@@ -160,6 +311,21 @@ void print_config(void)
            "inflow max velocity", lbm_gbl_config.inflow_max_velocity,
            "output filename", lbm_gbl_config.output_filename,
            "write interval", lbm_gbl_config.write_interval,
+           "thread domains", lbm_gbl_config.thread_domains,
+           "blocks per rank", lbm_gbl_config.blocks_per_rank,
+           "comm thread", lbm_gbl_config.comm_thread,
+           "scheduler", lbm_gbl_config.scheduler,
+           "scheduler chunk", lbm_gbl_config.sched_chunk,
+           "balance interval", lbm_gbl_config.balance_interval,
+           "halo backend", lbm_gbl_config.halo_backend,
+           "halo depth", lbm_gbl_config.halo_depth,
+           "halo precision", lbm_gbl_config.halo_precision,
+           "rank placement", lbm_gbl_config.rank_placement,
+           "output backend", lbm_gbl_config.output_backend,
+           "output buffers", lbm_gbl_config.output_buffers,
+           "io servers", lbm_gbl_config.io_servers,
+           "output compression", lbm_gbl_config.output_compression,
+           "output error bound", lbm_gbl_config.output_error_bound,
            "kinetic viscosity", lbm_gbl_config.kinetic_viscosity,
            "relax parameter", lbm_gbl_config.relax_parameter);
 }
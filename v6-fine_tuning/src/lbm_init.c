@@ -2,7 +2,11 @@
 #include "../include/lbm_phys.h"
 
 #include <assert.h>
+#include <math.h>
 #include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void init_cond_velocity_0_density_1(Mesh* mesh)
 {
@@ -21,16 +25,33 @@ void init_cond_velocity_0_density_1(Mesh* mesh)
 void setup_init_state_circle_obstacle(Mesh* mesh, lbm_mesh_type_t* mesh_type,
                                       lbm_comm_t const* mesh_comm)
 {
+    // Global position of the first cell of the local mesh, deep ghost layers
+    // may start before the global one
+    long const x0 = (long)mesh_comm->x + 1 - (long)mesh_comm->ghost;
+    long const y0 = (long)mesh_comm->y + 1 - (long)mesh_comm->ghost;
+
+    // Only loop on the bounding box of the obstacle (with a margin of one cell
+    // for rounding), clipped to the local mesh
+    long const x_min = (long)floor(OBSTACLE_X - OBSTACLE_R) - 1;
+    long const x_max = (long)ceil(OBSTACLE_X + OBSTACLE_R) + 1;
+    long const y_min = (long)floor(OBSTACLE_Y - OBSTACLE_R) - 1;
+    long const y_max = (long)ceil(OBSTACLE_Y + OBSTACLE_R) + 1;
+    long const i_begin = (x_min > x0) ? x_min : x0;
+    long const i_end = (x_max < (long)mesh->width + x0) ? x_max + 1
+                                                        : (long)mesh->width + x0;
+    long const j_begin = (y_min > y0) ? y_min : y0;
+    long const j_end = (y_max < (long)mesh->height + y0)
+                           ? y_max + 1
+                           : (long)mesh->height + y0;
+
     // Loop on nodes
-    for (size_t i = mesh_comm->x; i < mesh->width + mesh_comm->x; i++) {
-        for (size_t j = mesh_comm->y; j < mesh->height + mesh_comm->y; j++) {
+    #pragma omp parallel for schedule(static)
+    for (long i = i_begin; i < i_end; i++) {
+        for (long j = j_begin; j < j_end; j++) {
             if (((i - OBSTACLE_X) * (i - OBSTACLE_X)) + ((j - OBSTACLE_Y) * (j - OBSTACLE_Y)) <=
                 OBSTACLE_R * OBSTACLE_R)
             {
-                *(lbm_cell_type_t_get_cell(mesh_type, i - mesh_comm->x, j - mesh_comm->y)) = CELL_BOUNCE_BACK;
-                // for (size_t k = 0; k < DIMENSIONS; k++) {
-                //     mesh[i][j][k] = 0.0;
-                // }
+                *(lbm_cell_type_t_get_cell(mesh_type, i - x0, j - y0)) = CELL_BOUNCE_BACK;
             }
         }
     }
@@ -40,30 +61,40 @@ void setup_init_state_global_poiseuille_profile(Mesh* mesh,
                                                 lbm_mesh_type_t* mesh_type,
                                                 lbm_comm_t const* mesh_comm)
 {
-    Vector v = { 0.0, 0.0 };
     double const rho = 1.0;
 
-    int rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    // The profile only depends on `j`: compute one column and replicate it
+    double* column = malloc(mesh->height * DIRECTIONS * sizeof(double));
+    if (column == NULL) {
+        perror("malloc");
+        abort();
+    }
+    long const y0 = (long)mesh_comm->y + 1 - (long)mesh_comm->ghost;
+    long const y_last = MESH_HEIGHT + 1;
+    for (size_t j = 0; j < mesh->height; j++) {
+        // Deep ghost layers beyond the global borders replicate them
+        long y = (long)j + y0;
+        y = (y < 0) ? 0 : (y > y_last) ? y_last : y;
+        Vector v = { helper_compute_poiseuille(y, MESH_HEIGHT), 0.0 };
+        for (size_t k = 0; k < DIRECTIONS; k++) {
+            column[j * DIRECTIONS + k] = compute_equilibrium_profile(v, rho, k);
+        }
+    }
 
     // Apply Poiseuille distribution for all nodes except on top/bottom border
+    // Columns are touched first by the thread computing them in the time loop
+    #pragma omp parallel for schedule(static)
     for (size_t i = 0; i < mesh->width; i++) {
+        memcpy(Mesh_get_cell(mesh, i, 0), column,
+               mesh->height * DIRECTIONS * sizeof(double));
+        // Mark as standard fluid
+        lbm_cell_type_t* types = lbm_cell_type_t_get_cell(mesh_type, i, 0);
         for (size_t j = 0; j < mesh->height; j++) {
-            for (size_t k = 0; k < DIRECTIONS; k++) {
-                // Compute equilibrium
-                v[0] = helper_compute_poiseuille(j + mesh_comm->y, MESH_HEIGHT);
-                lbm_mesh_cell_t cell = Mesh_get_cell(mesh, i, j);
-                cell[k] = compute_equilibrium_profile(v, rho, k);
-                // Mark as standard fluid
-                *(lbm_cell_type_t_get_cell(mesh_type, i, j)) = CELL_FUILD;
-                // This is a try to init the fluid with a null speed except on
-                // the left border.
-                // if (i > 1) {
-                //     Mesh_get_cell(mesh, i, j)[k] = equil_weight[k];
-                // }
-            }
+            types[j] = CELL_FUILD;
         }
     }
+
+    free(column);
 }
 
 void setup_init_state_border(Mesh* mesh, lbm_mesh_type_t* mesh_type,
@@ -72,42 +103,52 @@ void setup_init_state_border(Mesh* mesh, lbm_mesh_type_t* mesh_type,
     Vector v = { 0.0, 0.0 };
     double const rho = 1.0;
 
+    // Equilibrium of a fluid at rest
+    double cell_at_rest[DIRECTIONS];
+    for (size_t k = 0; k < DIRECTIONS; k++) {
+        cell_at_rest[k] = compute_equilibrium_profile(v, rho, k);
+    }
+
+    // Borders are the ghost layers next to the local area, deeper layers
+    // replicate them
+    size_t const ghost = mesh_comm->ghost;
+
     // Setup left border type
     if (mesh_comm->left_id == -1) {
-        for (size_t j = 1; j < mesh->height - 1; j++) {
-            *(lbm_cell_type_t_get_cell(mesh_type, 0, j)) = CELL_LEFT_IN;
+        for (size_t j = ghost; j < mesh->height - ghost; j++) {
+            *(lbm_cell_type_t_get_cell(mesh_type, ghost - 1, j)) = CELL_LEFT_IN;
         }
     }
 
     // Setup right border type
     if (mesh_comm->right_id == -1) {
-        for (size_t j = 1; j < mesh->height - 1; j++) {
-            *(lbm_cell_type_t_get_cell(mesh_type, mesh->width - 1, j)) = CELL_RIGHT_OUT;
+        for (size_t j = ghost; j < mesh->height - ghost; j++) {
+            *(lbm_cell_type_t_get_cell(mesh_type, mesh->width - ghost, j)) = CELL_RIGHT_OUT;
         }
     }
 
     // Setup top border type
     if (mesh_comm->top_id == -1) {
+        #pragma omp parallel for schedule(static)
         for (size_t i = 0; i < mesh->width; i++) {
-            for (size_t k = 0; k < DIRECTIONS; k++) {
-                // Compute equilibrium.
-                Mesh_get_cell(mesh, i, 0)[k] =
-                    compute_equilibrium_profile(v, rho, k);
+            for (size_t j = 0; j < ghost; j++) {
+                memcpy(Mesh_get_cell(mesh, i, j), cell_at_rest,
+                       sizeof(cell_at_rest));
                 // Mark as bounce back
-                *(lbm_cell_type_t_get_cell(mesh_type, i, 0)) = CELL_BOUNCE_BACK;
+                *(lbm_cell_type_t_get_cell(mesh_type, i, j)) = CELL_BOUNCE_BACK;
             }
         }
     }
 
     // Setup bottom border type
     if (mesh_comm->bottom_id == -1) {
+        #pragma omp parallel for schedule(static)
         for (size_t i = 0; i < mesh->width; i++) {
-            for (size_t k = 0; k < DIRECTIONS; k++) {
-                // Compute equilibrium.
-                Mesh_get_cell(mesh, i, mesh->height - 1)[k] =
-                    compute_equilibrium_profile(v, rho, k);
+            for (size_t j = mesh->height - ghost; j < mesh->height; j++) {
+                memcpy(Mesh_get_cell(mesh, i, j), cell_at_rest,
+                       sizeof(cell_at_rest));
                 // Mark as bounce back
-                *(lbm_cell_type_t_get_cell(mesh_type, i, mesh->height - 1)) = CELL_BOUNCE_BACK;
+                *(lbm_cell_type_t_get_cell(mesh_type, i, j)) = CELL_BOUNCE_BACK;
             }
         }
     }
@@ -120,3 +161,13 @@ void setup_init_state(Mesh* mesh, lbm_mesh_type_t* mesh_type,
     setup_init_state_border(mesh, mesh_type, mesh_comm);
     setup_init_state_circle_obstacle(mesh, mesh_type, mesh_comm);
 }
+
+void setup_init_state_copy(Mesh* mesh_out, Mesh const* mesh_in)
+{
+    // Same column distribution as the initialization
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < mesh_in->width; i++) {
+        memcpy(Mesh_get_cell(mesh_out, i, 0), Mesh_get_cell(mesh_in, i, 0),
+               mesh_in->height * DIRECTIONS * sizeof(double));
+    }
+}
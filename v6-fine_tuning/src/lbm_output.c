@@ -0,0 +1,1097 @@
+#include "lbm_output.h"
+
+#include "lbm_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Tag announcing the end of the output to the I/O servers, frames are tagged
+/// with their index modulo this value.
+#define LBM_OUTPUT_END_TAG 32767
+
+/**
+ * @brief Header of the output file.
+ * It essentialy provides information on the size of the mesh.
+ **/
+static lbm_file_header_t lbm_output_header(void)
+{
+    lbm_file_header_t const header = {
+        .magick = (lbm_gbl_config.output_compression == COMPRESSION_LOSSY)
+                      ? RESULT_MAGICK_LOSSY
+                  : (lbm_gbl_config.output_compression == COMPRESSION_LOSSLESS)
+                      ? RESULT_MAGICK_COMPRESSED
+                      : RESULT_MAGICK,
+        .mesh_height = MESH_HEIGHT,
+        .mesh_width = MESH_WIDTH,
+        // Frames are assembled in the global column-major order, whatever
+        // the decomposition
+        .lines = 1,
+    };
+    return header;
+}
+
+/**
+ * @brief Returns the entry of a frame being written, growing the index if
+ * needed.
+ *
+ * @param index Index of the frames.
+ * @param capacity Number of entries `index` can hold.
+ * @param frame Frame being written, right after the last one of the index.
+ * @return Entry of the frame.
+ **/
+static lbm_file_index_entry_t* lbm_output_index_entry(
+    lbm_file_index_entry_t** index, uint32_t* capacity, uint32_t frame)
+{
+    if (frame == *capacity) {
+        *capacity = (*capacity > 0) ? 2 * *capacity : 64;
+        *index = realloc(*index, *capacity * sizeof(lbm_file_index_entry_t));
+        if (*index == NULL) {
+            perror("realloc");
+            abort();
+        }
+    }
+    return &(*index)[frame];
+}
+
+/**
+ * @brief Fills the index of frames stored raw, one after the other.
+ *
+ * @param index Index to fill, checksums excluded.
+ * @param nb_frames Number of frames.
+ **/
+static void lbm_output_index_raw(lbm_file_index_entry_t* index,
+                                 uint32_t nb_frames)
+{
+    uint64_t const frame_size =
+        (uint64_t)MESH_WIDTH * MESH_HEIGHT * sizeof(lbm_file_entry_t);
+    for (uint32_t f = 0; f < nb_frames; f++) {
+        index[f].offset = sizeof(lbm_file_header_t) + f * frame_size;
+        index[f].size = frame_size;
+        index[f].iteration = f * WRITE_STEP_INTERVAL;
+        index[f].key = f;
+    }
+}
+
+/**
+ * @brief Sums the checksums of the cells of each frame written by the ranks of
+ * a communicator on its first rank.
+ *
+ * @param index Index holding the checksums of the calling rank.
+ * @param nb_frames Number of frames.
+ * @param comm Communicator of the ranks.
+ **/
+static void lbm_output_reduce_checksums(lbm_file_index_entry_t* index,
+                                        uint32_t nb_frames, MPI_Comm comm)
+{
+    uint64_t* checksums = malloc(nb_frames * sizeof(uint64_t));
+    if (checksums == NULL && nb_frames > 0) {
+        perror("malloc");
+        abort();
+    }
+    for (uint32_t f = 0; f < nb_frames; f++) {
+        checksums[f] = index[f].checksum;
+    }
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Reduce((rank == 0) ? MPI_IN_PLACE : checksums, checksums, nb_frames,
+               MPI_UINT64_T, MPI_SUM, 0, comm);
+    for (uint32_t f = 0; f < nb_frames; f++) {
+        index[f].checksum = checksums[f];
+    }
+    free(checksums);
+}
+
+/**
+ * @brief Builds the index of the frames followed by the footer of the file.
+ *
+ * @param index Index of the frames.
+ * @param nb_frames Number of frames.
+ * @param size Size of the index and footer.
+ * @return Bytes to append to the file.
+ **/
+static uint8_t* lbm_output_footer(lbm_file_index_entry_t const* index,
+                                  uint32_t nb_frames, size_t* size)
+{
+    lbm_file_footer_t const footer = {
+        .magick = RESULT_MAGICK_INDEX,
+        .nb_frames = nb_frames,
+    };
+    *size = nb_frames * sizeof(lbm_file_index_entry_t) + sizeof(footer);
+    uint8_t* bytes = malloc(*size);
+    if (bytes == NULL) {
+        perror("malloc");
+        abort();
+    }
+    memcpy(bytes, index, nb_frames * sizeof(lbm_file_index_entry_t));
+    memcpy(&bytes[nb_frames * sizeof(lbm_file_index_entry_t)], &footer,
+           sizeof(footer));
+    return bytes;
+}
+
+/**
+ * @brief Computes the area of the cells of a rank, phantom meshes excluded.
+ *
+ * @param mesh_comm Rank-level communicator.
+ * @param rank Rank in `mesh_comm->comm`.
+ * @param area X, Y, width and height of the cells of the rank.
+ **/
+static void lbm_output_rank_area(lbm_comm_t const* mesh_comm, int rank,
+                                 uint32_t area[4])
+{
+    lbm_comm_rank_area(mesh_comm, rank, &area[0], &area[1], &area[2],
+                       &area[3]);
+    area[2] -= 2 * mesh_comm->ghost;
+    area[3] -= 2 * mesh_comm->ghost;
+}
+
+/**
+ * @brief Copies the frame entries of the cells of the calling rank into a
+ * buffer, growing it if needed.
+ *
+ * @param buffer Buffer to fill.
+ * @param mesh_comm Rank-level communicator.
+ * @param mesh Local mesh to save.
+ **/
+static void lbm_output_fill(lbm_output_buffer_t* buffer,
+                            lbm_comm_t const* mesh_comm, Mesh const* mesh)
+{
+    int rank;
+    MPI_Comm_rank(mesh_comm->comm, &rank);
+    lbm_output_rank_area(mesh_comm, rank, buffer->area);
+    size_t const size = (size_t)buffer->area[2] * buffer->area[3];
+    if (size > buffer->capacity) {
+        free(buffer->entries);
+        buffer->entries = malloc(size * sizeof(lbm_file_entry_t));
+        if (buffer->entries == NULL) {
+            perror("malloc");
+            abort();
+        }
+        buffer->capacity = size;
+    }
+    fill_frame(buffer->entries, buffer->area[3], mesh, mesh_comm->ghost);
+}
+
+/**
+ * @brief Opens the output file on every rank of a communicator, truncated in
+ * case it already exists, and writes its header from the first rank.
+ *
+ * @param comm Communicator of the writing ranks.
+ * @param file Opened file.
+ **/
+static void lbm_output_open_shared(MPI_Comm comm, MPI_File* file)
+{
+    if (MPI_File_open(comm, RESULT_FILENAME,
+                      MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                      file) != MPI_SUCCESS) {
+        fatal("Failed to open the output file with MPI-IO.");
+    }
+    MPI_File_set_size(*file, 0);
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+        lbm_file_header_t const header = lbm_output_header();
+        MPI_File_write_at(*file, 0, &header, sizeof(header), MPI_BYTE,
+                          MPI_STATUS_IGNORE);
+    }
+}
+
+/**
+ * @brief Writes the cells of the calling rank at their place in the current
+ * frame of the file, collectively with the other ranks.
+ *
+ * @param output Output to write to.
+ * @param entries Frame entries of the cells of the rank.
+ * @param area X, Y, width and height of the cells of the rank.
+ **/
+static void lbm_output_write_area(lbm_output_t* output,
+                                  lbm_file_entry_t const* entries,
+                                  uint32_t const area[4])
+{
+    // The view only exposes the cells of the rank in the current frame. It is
+    // set again for every frame as the load balancer may move them.
+    int const sizes[2] = { MESH_WIDTH, MESH_HEIGHT };
+    int const subsizes[2] = { area[2], area[3] };
+    int const starts[2] = { area[0], area[1] };
+    MPI_Datatype area_type;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+                             output->entry_type, &area_type);
+    MPI_Type_commit(&area_type);
+
+    MPI_Offset const frame_size =
+        (MPI_Offset)MESH_WIDTH * MESH_HEIGHT * sizeof(lbm_file_entry_t);
+    MPI_File_set_view(output->file,
+                      sizeof(lbm_file_header_t) +
+                          output->nb_frames * frame_size,
+                      output->entry_type, area_type, "native", MPI_INFO_NULL);
+    MPI_File_write_at_all(output->file, 0, entries, area[2] * area[3],
+                          output->entry_type, MPI_STATUS_IGNORE);
+
+    MPI_Type_free(&area_type);
+}
+
+/**
+ * @brief Appends a compressed frame to the file of the master.
+ *
+ * @param output Output to write to.
+ * @param frame Frame to write, replaced by its decoded entries if lossy.
+ **/
+static void lbm_output_compress(lbm_output_t* output, lbm_file_entry_t* frame)
+{
+    lbm_codec_record_t record;
+    if (lbm_gbl_config.output_compression == COMPRESSION_LOSSY) {
+        record.size = lbm_codec_encode_lossy(
+            output->codec, frame, lbm_gbl_config.output_error_bound);
+        if (output->codec->max_error > output->max_error) {
+            output->max_error = output->codec->max_error;
+        }
+    } else {
+        record.size = lbm_codec_encode(output->codec, frame);
+    }
+    fwrite(&record, sizeof(record), 1, output->fp);
+    fwrite(output->codec->payload, 1, record.size, output->fp);
+    output->stored_bytes += sizeof(record) + record.size;
+}
+
+/**
+ * @brief Appends a whole frame to the file of the master, compressed if
+ * requested.
+ *
+ * @param output Output to write to.
+ * @param frame Frame to write, replaced by its decoded entries if lossy.
+ **/
+static void lbm_output_store(lbm_output_t* output, lbm_file_entry_t* frame)
+{
+    size_t const frame_size = (size_t)MESH_WIDTH * MESH_HEIGHT;
+    lbm_file_index_entry_t* entry = lbm_output_index_entry(
+        &output->index, &output->index_capacity, output->nb_frames);
+    entry->offset = sizeof(lbm_file_header_t) + output->stored_bytes;
+    entry->iteration = output->nb_frames * WRITE_STEP_INTERVAL;
+    entry->key = output->nb_frames;
+    output->raw_bytes += frame_size * sizeof(lbm_file_entry_t);
+    if (output->codec == NULL) {
+        fwrite(frame, sizeof(lbm_file_entry_t), frame_size, output->fp);
+        output->stored_bytes += frame_size * sizeof(lbm_file_entry_t);
+    } else {
+        lbm_output_compress(output, frame);
+        entry->key -= output->nb_frames % LBM_CODEC_KEY_INTERVAL;
+    }
+    entry->size = sizeof(lbm_file_header_t) + output->stored_bytes -
+                  entry->offset;
+
+    // Lossy frames now hold the entries that readers decode
+    uint32_t const area[4] = { 0, 0, MESH_WIDTH, MESH_HEIGHT };
+    entry->checksum = lbm_codec_checksum(frame, area, MESH_HEIGHT);
+}
+
+/**
+ * @brief Records the checksum of the cells of the calling rank in the index.
+ *
+ * @param output Output being written.
+ * @param buffer Snapshot of the rank.
+ **/
+static void lbm_output_record(lbm_output_t* output,
+                              lbm_output_buffer_t const* buffer)
+{
+    lbm_file_index_entry_t* entry = lbm_output_index_entry(
+        &output->index, &output->index_capacity, output->nb_frames);
+    entry->checksum =
+        lbm_codec_checksum(buffer->entries, buffer->area, MESH_HEIGHT);
+}
+
+/**
+ * @brief Records the areas of all ranks in the snapshot of the master.
+ *
+ * @param buffer Snapshot of the master.
+ * @param mesh_comm Rank-level communicator.
+ **/
+static void lbm_output_fill_areas(lbm_output_buffer_t* buffer,
+                                  lbm_comm_t const* mesh_comm)
+{
+    int comm_size;
+    MPI_Comm_size(mesh_comm->comm, &comm_size);
+    for (int i = 0; i < comm_size; i++) {
+        lbm_output_rank_area(mesh_comm, i, &buffer->areas[4 * i]);
+    }
+}
+
+/**
+ * @brief Assembles a frame from the snapshots of all ranks on the master,
+ * which appends it to the file.
+ *
+ * @param output Output to write to.
+ * @param buffer Snapshot of the calling rank.
+ **/
+static void lbm_output_gather(lbm_output_t* output,
+                              lbm_output_buffer_t const* buffer)
+{
+    int comm_size, rank;
+    MPI_Comm_size(output->comm, &comm_size);
+    MPI_Comm_rank(output->comm, &rank);
+    uint32_t const* area = buffer->area;
+
+    if (rank != RANK_MASTER) {
+        MPI_Send(buffer->entries, area[2] * area[3] * 2, MPI_FLOAT,
+                 RANK_MASTER, 0, output->comm);
+        return;
+    }
+
+    // The master copies its own cells and receives the others in place
+    for (uint32_t i = 0; i < area[2]; i++) {
+        memcpy(&output->frame[(size_t)(area[0] + i) * MESH_HEIGHT + area[1]],
+               &buffer->entries[(size_t)i * area[3]],
+               area[3] * sizeof(lbm_file_entry_t));
+    }
+    for (int i = 1; i < comm_size; i++) {
+        uint32_t const* other = &buffer->areas[4 * i];
+        MPI_Datatype block_type;
+        MPI_Type_vector(other[2], other[3] * 2, MESH_HEIGHT * 2, MPI_FLOAT,
+                        &block_type);
+        MPI_Type_commit(&block_type);
+        MPI_Recv(&output->frame[(size_t)other[0] * MESH_HEIGHT + other[1]], 1,
+                 block_type, i, 0, output->comm, MPI_STATUS_IGNORE);
+        MPI_Type_free(&block_type);
+    }
+
+    lbm_output_store(output, output->frame);
+}
+
+/**
+ * @brief Column of a rank, contiguous in the file, in frame entries.
+ **/
+typedef struct lbm_output_run_s {
+    /// Offset of the first cell in the frame of the file.
+    MPI_Aint start;
+    /// Offset of the first cell in the entries packed by the aggregator.
+    MPI_Aint packed;
+    int length;
+} lbm_output_run_t;
+
+static int lbm_output_run_compare(void const* a, void const* b)
+{
+    MPI_Aint const first = ((lbm_output_run_t const*)a)->start;
+    MPI_Aint const second = ((lbm_output_run_t const*)b)->start;
+    return (first > second) - (first < second);
+}
+
+/**
+ * @brief Gathers the snapshots of the ranks of a node on its aggregator, which
+ * writes the cells of the node at their place in the current frame of the
+ * file, independently of the other aggregators.
+ *
+ * @param output Output to write to.
+ * @param buffer Snapshot of the calling rank.
+ **/
+static void lbm_output_aggregate(lbm_output_t* output,
+                                 lbm_output_buffer_t const* buffer)
+{
+    int node_rank, node_size;
+    MPI_Comm_rank(output->node_comm, &node_rank);
+    MPI_Comm_size(output->node_comm, &node_size);
+    uint32_t const* area = buffer->area;
+
+    // Areas are gathered first as the load balancer may move them
+    MPI_Gather(area, 4, MPI_UINT32_T, output->node_areas, 4, MPI_UINT32_T, 0,
+               output->node_comm);
+    if (node_rank != 0) {
+        MPI_Send(buffer->entries, area[2] * area[3], output->entry_type, 0, 0,
+                 output->node_comm);
+        return;
+    }
+
+    // The aggregator only holds the cells of the node, packed rank after rank
+    // as their snapshots are
+    size_t nb_cells = 0;
+    int nb_runs = 0;
+    for (int i = 0; i < node_size; i++) {
+        uint32_t const* other = &output->node_areas[4 * i];
+        nb_cells += (size_t)other[2] * other[3];
+        nb_runs += other[2];
+    }
+    if (nb_cells > output->node_capacity) {
+        free(output->node_entries);
+        output->node_entries = malloc(nb_cells * sizeof(lbm_file_entry_t));
+        if (output->node_entries == NULL) {
+            perror("malloc");
+            abort();
+        }
+        output->node_capacity = nb_cells;
+    }
+    memcpy(output->node_entries, buffer->entries,
+           (size_t)area[2] * area[3] * sizeof(lbm_file_entry_t));
+    size_t packed = (size_t)area[2] * area[3];
+    for (int i = 1; i < node_size; i++) {
+        uint32_t const* other = &output->node_areas[4 * i];
+        MPI_Recv(&output->node_entries[packed], other[2] * other[3],
+                 output->entry_type, i, 0, output->node_comm,
+                 MPI_STATUS_IGNORE);
+        packed += (size_t)other[2] * other[3];
+    }
+
+    // One run per column of each rank, sorted in the order of the file
+    lbm_output_run_t* runs = malloc(nb_runs * sizeof(lbm_output_run_t));
+    if (runs == NULL) {
+        perror("malloc");
+        abort();
+    }
+    nb_runs = 0;
+    packed = 0;
+    for (int i = 0; i < node_size; i++) {
+        uint32_t const* other = &output->node_areas[4 * i];
+        for (uint32_t x = 0; x < other[2]; x++) {
+            runs[nb_runs].start = (MPI_Aint)(other[0] + x) * MESH_HEIGHT +
+                                  other[1];
+            runs[nb_runs].packed = packed;
+            runs[nb_runs].length = other[3];
+            packed += other[3];
+            nb_runs++;
+        }
+    }
+    qsort(runs, nb_runs, sizeof(lbm_output_run_t), lbm_output_run_compare);
+
+    // The columns are picked from the packed entries in the order of the
+    // file, while the file type merges those following each other in the file
+    // (e.g. whole columns of a tile of ranks)
+    int* lengths = malloc(nb_runs * sizeof(int));
+    MPI_Aint* displacements = malloc(nb_runs * sizeof(MPI_Aint));
+    int* file_lengths = malloc(nb_runs * sizeof(int));
+    MPI_Aint* file_displacements = malloc(nb_runs * sizeof(MPI_Aint));
+    if (lengths == NULL || displacements == NULL || file_lengths == NULL ||
+        file_displacements == NULL) {
+        perror("malloc");
+        abort();
+    }
+    int nb_merged = 0;
+    for (int i = 0; i < nb_runs; i++) {
+        lengths[i] = runs[i].length;
+        displacements[i] = runs[i].packed * sizeof(lbm_file_entry_t);
+        if (nb_merged > 0 && runs[i - 1].start + runs[i - 1].length ==
+                                 runs[i].start) {
+            file_lengths[nb_merged - 1] += runs[i].length;
+        } else {
+            file_lengths[nb_merged] = runs[i].length;
+            file_displacements[nb_merged] =
+                runs[i].start * sizeof(lbm_file_entry_t);
+            nb_merged++;
+        }
+    }
+    MPI_Datatype memory_type, runs_type;
+    MPI_Type_create_hindexed(nb_runs, lengths, displacements,
+                             output->entry_type, &memory_type);
+    MPI_Type_commit(&memory_type);
+    MPI_Type_create_hindexed(nb_merged, file_lengths, file_displacements,
+                             output->entry_type, &runs_type);
+    MPI_Type_commit(&runs_type);
+
+    MPI_Offset const frame_size =
+        (MPI_Offset)MESH_WIDTH * MESH_HEIGHT * sizeof(lbm_file_entry_t);
+    MPI_File_set_view(output->file,
+                      sizeof(lbm_file_header_t) +
+                          output->nb_frames * frame_size,
+                      output->entry_type, runs_type, "native", MPI_INFO_NULL);
+    MPI_File_write_at(output->file, 0, output->node_entries, 1, memory_type,
+                      MPI_STATUS_IGNORE);
+
+    MPI_Type_free(&runs_type);
+    MPI_Type_free(&memory_type);
+    free(file_displacements);
+    free(file_lengths);
+    free(displacements);
+    free(lengths);
+    free(runs);
+}
+
+/**
+ * @brief Main function of the writer thread: writes the snapshots in the
+ * order they were taken, until the output is closed.
+ *
+ * @param arg Output to drain.
+ * @return NULL.
+ **/
+static void* lbm_output_writer_main(void* arg)
+{
+    lbm_output_t* output = arg;
+
+    pthread_mutex_lock(&output->lock);
+    while (true) {
+        while (output->nb_ready == 0 && !output->done) {
+            pthread_cond_wait(&output->ready, &output->lock);
+        }
+        if (output->nb_ready == 0) {
+            break;
+        }
+        lbm_output_buffer_t* buffer = &output->buffers[output->head];
+        pthread_mutex_unlock(&output->lock);
+
+        double const before = MPI_Wtime();
+        if (output->backend == OUTPUT_POSIX) {
+            lbm_output_gather(output, buffer);
+        } else if (output->backend == OUTPUT_NODE) {
+            lbm_output_aggregate(output, buffer);
+            lbm_output_record(output, buffer);
+        } else {
+            lbm_output_write_area(output, buffer->entries, buffer->area);
+            lbm_output_record(output, buffer);
+        }
+        output->nb_frames++;
+        output->write_time += MPI_Wtime() - before;
+
+        pthread_mutex_lock(&output->lock);
+        output->head = (output->head + 1) % output->nb_buffers;
+        output->nb_ready--;
+        pthread_cond_signal(&output->free);
+    }
+    pthread_mutex_unlock(&output->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Allocates the snapshot buffers and starts the writer thread.
+ *
+ * @param output Opened output.
+ * @param rank Rank in the communicator of the output.
+ **/
+static void lbm_output_start_writer(lbm_output_t* output, int rank)
+{
+    int provided;
+    MPI_Query_thread(&provided);
+    if (provided < MPI_THREAD_MULTIPLE) {
+        fatal("Asynchronous output requires MPI_THREAD_MULTIPLE.");
+    }
+
+    int comm_size;
+    MPI_Comm_size(output->comm, &comm_size);
+    bool const assemble = output->backend == OUTPUT_POSIX &&
+                          rank == RANK_MASTER;
+    output->buffers = calloc(output->nb_buffers, sizeof(lbm_output_buffer_t));
+    if (output->buffers == NULL) {
+        perror("calloc");
+        abort();
+    }
+    for (uint32_t i = 0; i < output->nb_buffers && assemble; i++) {
+        output->buffers[i].areas = malloc(4 * comm_size * sizeof(uint32_t));
+        if (output->buffers[i].areas == NULL) {
+            perror("malloc");
+            abort();
+        }
+    }
+
+    pthread_mutex_init(&output->lock, NULL);
+    pthread_cond_init(&output->ready, NULL);
+    pthread_cond_init(&output->free, NULL);
+    if (pthread_create(&output->writer, NULL, lbm_output_writer_main,
+                       output) != 0) {
+        perror("pthread_create");
+        abort();
+    }
+}
+
+void lbm_output_serve(MPI_Comm servers)
+{
+    // No output if empty filename
+    if (RESULT_FILENAME == NULL) {
+        return;
+    }
+
+    int rank, nb_servers;
+    MPI_Comm_rank(servers, &rank);
+    MPI_Comm_size(servers, &nb_servers);
+    MPI_Comm inter;
+    MPI_Intercomm_create(servers, 0, MPI_COMM_WORLD, RANK_MASTER, 0, &inter);
+    int grid[2];
+    MPI_Bcast(grid, 2, MPI_INT, 0, inter);
+
+    // Each server gets a band of columns of ranks, which covers whole columns
+    // of the mesh and is thus contiguous in each frame of the file
+    int const nb_senders = (lbm_comm_split(grid[0], nb_servers, rank + 1) -
+                            lbm_comm_split(grid[0], nb_servers, rank)) *
+                           grid[1];
+    MPI_File file;
+    lbm_output_open_shared(servers, &file);
+    MPI_Datatype entry_type;
+    MPI_Type_contiguous(2, MPI_FLOAT, &entry_type);
+    MPI_Type_commit(&entry_type);
+    lbm_file_entry_t* frame =
+        malloc((size_t)MESH_WIDTH * MESH_HEIGHT * sizeof(lbm_file_entry_t));
+    if (frame == NULL) {
+        perror("malloc");
+        abort();
+    }
+
+    // The number of frames is only known when the compute ranks are done
+    uint32_t nb_frames = UINT32_MAX;
+    double write_time = 0.0;
+    lbm_file_index_entry_t* index = NULL;
+    uint32_t index_capacity = 0;
+    for (uint32_t f = 0; f < nb_frames;) {
+        MPI_Status status;
+        MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, inter, &status);
+        if (status.MPI_TAG == LBM_OUTPUT_END_TAG) {
+            MPI_Recv(&nb_frames, 1, MPI_UINT32_T, status.MPI_SOURCE,
+                     LBM_OUTPUT_END_TAG, inter, MPI_STATUS_IGNORE);
+            continue;
+        }
+
+        // Areas are received first as the load balancer may move them
+        int const tag = f % LBM_OUTPUT_END_TAG;
+        uint32_t first = MESH_WIDTH, last = 0;
+        for (int i = 0; i < nb_senders; i++) {
+            uint32_t area[4];
+            MPI_Recv(area, 4, MPI_UINT32_T, MPI_ANY_SOURCE, tag, inter,
+                     &status);
+            MPI_Datatype block_type;
+            MPI_Type_vector(area[2], area[3] * 2, MESH_HEIGHT * 2, MPI_FLOAT,
+                            &block_type);
+            MPI_Type_commit(&block_type);
+            MPI_Recv(&frame[(size_t)area[0] * MESH_HEIGHT + area[1]], 1,
+                     block_type, status.MPI_SOURCE, tag, inter,
+                     MPI_STATUS_IGNORE);
+            MPI_Type_free(&block_type);
+            first = (area[0] < first) ? area[0] : first;
+            last = (area[0] + area[2] > last) ? area[0] + area[2] : last;
+        }
+
+        double const before = MPI_Wtime();
+        MPI_Offset const frame_size =
+            (MPI_Offset)MESH_WIDTH * MESH_HEIGHT * sizeof(lbm_file_entry_t);
+        MPI_File_write_at(file,
+                          sizeof(lbm_file_header_t) + f * frame_size +
+                              (MPI_Offset)first * MESH_HEIGHT *
+                                  sizeof(lbm_file_entry_t),
+                          &frame[(size_t)first * MESH_HEIGHT],
+                          (last - first) * MESH_HEIGHT, entry_type,
+                          MPI_STATUS_IGNORE);
+        uint32_t const band[4] = { first, 0, last - first, MESH_HEIGHT };
+        lbm_output_index_entry(&index, &index_capacity, f)->checksum =
+            lbm_codec_checksum(&frame[(size_t)first * MESH_HEIGHT], band,
+                               MESH_HEIGHT);
+        write_time += MPI_Wtime() - before;
+        f++;
+    }
+
+    // The first server appends the index of the frames
+    lbm_output_reduce_checksums(index, nb_frames, servers);
+    if (rank == 0) {
+        lbm_output_index_raw(index, nb_frames);
+        size_t size;
+        uint8_t* footer = lbm_output_footer(index, nb_frames, &size);
+        MPI_File_write_at(file,
+                          sizeof(lbm_file_header_t) +
+                              (MPI_Offset)nb_frames * MESH_WIDTH *
+                                  MESH_HEIGHT * sizeof(lbm_file_entry_t),
+                          footer, size, MPI_BYTE, MPI_STATUS_IGNORE);
+        free(footer);
+    }
+    free(index);
+
+    // The compute ranks report the time of the slowest server
+    double max_write_time;
+    MPI_Reduce(&write_time, &max_write_time, 1, MPI_DOUBLE, MPI_MAX, 0,
+               servers);
+    MPI_Bcast(&max_write_time, 1, MPI_DOUBLE,
+              (rank == 0) ? MPI_ROOT : MPI_PROC_NULL, inter);
+
+    free(frame);
+    MPI_Type_free(&entry_type);
+    MPI_File_close(&file);
+    MPI_Comm_free(&inter);
+}
+
+/**
+ * @brief Elects the aggregator of each node, which opens the file.
+ *
+ * @param output Output to open.
+ * @param rank Rank in the communicator of the output.
+ **/
+static void lbm_output_open_node(lbm_output_t* output, int rank)
+{
+    MPI_Comm_split_type(output->comm, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &output->node_comm);
+    int node_rank, node_size;
+    MPI_Comm_rank(output->node_comm, &node_rank);
+    MPI_Comm_size(output->node_comm, &node_size);
+    int const aggregator = (node_rank == 0);
+    MPI_Comm_split(output->comm, aggregator ? 0 : MPI_UNDEFINED, rank,
+                   &output->aggregators);
+    MPI_Allreduce(&aggregator, &output->nb_writers, 1, MPI_INT, MPI_SUM,
+                  output->comm);
+    if (!aggregator) {
+        return;
+    }
+
+    lbm_output_open_shared(output->aggregators, &output->file);
+    output->node_areas = malloc(4 * node_size * sizeof(uint32_t));
+    if (output->node_areas == NULL) {
+        perror("malloc");
+        abort();
+    }
+}
+
+/**
+ * @brief Connects the compute ranks to the I/O servers and assigns each rank
+ * the server of its column of ranks.
+ *
+ * @param output Output to open.
+ * @param mesh_comm Rank-level communicator.
+ **/
+static void lbm_output_connect(lbm_output_t* output,
+                               lbm_comm_t const* mesh_comm)
+{
+    // The I/O servers are the last ranks of `MPI_COMM_WORLD`
+    int world_size, rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    MPI_Comm_rank(mesh_comm->world, &rank);
+    int const nb_servers = lbm_gbl_config.io_servers;
+    MPI_Intercomm_create(mesh_comm->world, 0, MPI_COMM_WORLD,
+                         world_size - nb_servers, 0, &output->comm);
+    if (nb_servers > mesh_comm->nb_x) {
+        fatal("There are more I/O servers than columns of ranks.");
+    }
+    int grid[2] = { mesh_comm->nb_x, mesh_comm->nb_y };
+    MPI_Bcast(grid, 2, MPI_INT, (rank == 0) ? MPI_ROOT : MPI_PROC_NULL,
+              output->comm);
+
+    int coords[2];
+    MPI_Comm_rank(mesh_comm->comm, &rank);
+    MPI_Cart_coords(mesh_comm->comm, rank, 2, coords);
+    output->server = 0;
+    while ((int)lbm_comm_split(mesh_comm->nb_x, nb_servers,
+                               output->server + 1) <= coords[1]) {
+        output->server++;
+    }
+
+    // Frames in flight, double-buffered unless asked otherwise
+    output->backend = OUTPUT_SERVERS;
+    output->nb_buffers = (lbm_gbl_config.output_buffers > 0)
+                             ? lbm_gbl_config.output_buffers
+                             : 2;
+    output->buffers = calloc(output->nb_buffers, sizeof(lbm_output_buffer_t));
+    if (output->buffers == NULL) {
+        perror("calloc");
+        abort();
+    }
+    for (uint32_t i = 0; i < output->nb_buffers; i++) {
+        output->buffers[i].requests[0] = MPI_REQUEST_NULL;
+        output->buffers[i].requests[1] = MPI_REQUEST_NULL;
+    }
+}
+
+/**
+ * @brief Sends the frame entries of the rank to its I/O server without
+ * waiting for their delivery.
+ *
+ * @param output Output to write to.
+ * @param mesh_comm Rank-level communicator.
+ * @param mesh Local mesh to save.
+ **/
+static void lbm_output_send(lbm_output_t* output, lbm_comm_t const* mesh_comm,
+                            Mesh const* mesh)
+{
+    // Back-pressure: wait for the oldest frame in flight to leave its buffer
+    lbm_output_buffer_t* buffer =
+        &output->buffers[output->nb_frames % output->nb_buffers];
+    double const before = MPI_Wtime();
+    MPI_Waitall(2, buffer->requests, MPI_STATUSES_IGNORE);
+    output->stall_time += MPI_Wtime() - before;
+
+    lbm_output_fill(buffer, mesh_comm, mesh);
+    int const tag = output->nb_frames % LBM_OUTPUT_END_TAG;
+    MPI_Isend(buffer->area, 4, MPI_UINT32_T, output->server, tag,
+              output->comm, &buffer->requests[0]);
+    MPI_Isend(buffer->entries, buffer->area[2] * buffer->area[3],
+              output->entry_type, output->server, tag, output->comm,
+              &buffer->requests[1]);
+    output->nb_frames++;
+}
+
+/**
+ * @brief Waits for the frames in flight and tells the I/O servers how many
+ * frames to expect, then gets their writing time.
+ *
+ * @param output Output to close.
+ **/
+static void lbm_output_disconnect(lbm_output_t* output)
+{
+    for (uint32_t i = 0; i < output->nb_buffers; i++) {
+        MPI_Waitall(2, output->buffers[i].requests, MPI_STATUSES_IGNORE);
+    }
+
+    int rank, nb_servers;
+    MPI_Comm_rank(output->comm, &rank);
+    MPI_Comm_remote_size(output->comm, &nb_servers);
+    if (rank == 0) {
+        for (int i = 0; i < nb_servers; i++) {
+            MPI_Send(&output->nb_frames, 1, MPI_UINT32_T, i,
+                     LBM_OUTPUT_END_TAG, output->comm);
+        }
+    }
+    MPI_Bcast(&output->write_time, 1, MPI_DOUBLE, 0, output->comm);
+}
+
+void lbm_output_open(lbm_output_t* output, lbm_comm_t const* mesh_comm)
+{
+    output->backend = lbm_gbl_config.output_backend;
+    output->fp = NULL;
+    output->file = MPI_FILE_NULL;
+    output->comm = MPI_COMM_NULL;
+    output->server = MPI_PROC_NULL;
+    output->node_comm = MPI_COMM_NULL;
+    output->aggregators = MPI_COMM_NULL;
+    output->node_areas = NULL;
+    output->node_entries = NULL;
+    output->node_capacity = 0;
+    output->nb_writers = 0;
+    output->codec = NULL;
+    output->raw_bytes = 0;
+    output->stored_bytes = 0;
+    output->max_error = 0.0;
+    output->nb_frames = 0;
+    output->index = NULL;
+    output->index_capacity = 0;
+    output->time = 0.0;
+    output->stall_time = 0.0;
+    output->write_time = 0.0;
+    output->nb_buffers = 0;
+    output->buffers = NULL;
+    output->head = 0;
+    output->nb_ready = 0;
+    output->done = false;
+    output->frame = NULL;
+    MPI_Type_contiguous(2, MPI_FLOAT, &output->entry_type);
+    MPI_Type_commit(&output->entry_type);
+
+    // No output if empty filename
+    if (RESULT_FILENAME == NULL) {
+        return;
+    }
+
+    if (lbm_gbl_config.output_compression != COMPRESSION_NONE &&
+        (output->backend != OUTPUT_POSIX || lbm_gbl_config.io_servers > 0)) {
+        fatal("Compressed frames are only written by the posix backend.");
+    }
+    if (lbm_gbl_config.io_servers > 0) {
+        output->nb_writers = lbm_gbl_config.io_servers;
+        lbm_output_connect(output, mesh_comm);
+        return;
+    }
+
+    MPI_Comm_dup(mesh_comm->comm, &output->comm);
+    int rank;
+    MPI_Comm_rank(output->comm, &rank);
+    MPI_Comm_size(output->comm, &output->nb_writers);
+
+    if (output->backend == OUTPUT_POSIX) {
+        // Master open the output file
+        if (rank == RANK_MASTER) {
+            output->fp = fopen(RESULT_FILENAME, "wb");
+            if (output->fp == NULL) {
+                perror(RESULT_FILENAME);
+                abort();
+            }
+            lbm_file_header_t const header = lbm_output_header();
+            fwrite(&header, sizeof(header), 1, output->fp);
+
+            // The master assembles whole frames
+            output->frame = malloc((size_t)MESH_WIDTH * MESH_HEIGHT *
+                                   sizeof(lbm_file_entry_t));
+            if (output->frame == NULL) {
+                perror("malloc");
+                abort();
+            }
+            if (lbm_gbl_config.output_compression != COMPRESSION_NONE) {
+                output->codec = malloc(sizeof(lbm_codec_t));
+                if (output->codec == NULL) {
+                    perror("malloc");
+                    abort();
+                }
+                lbm_codec_init(output->codec, MESH_WIDTH, MESH_HEIGHT);
+            }
+        }
+        output->nb_writers = 1;
+    } else if (output->backend == OUTPUT_NODE) {
+        lbm_output_open_node(output, rank);
+    } else {
+        lbm_output_open_shared(output->comm, &output->file);
+    }
+
+    output->nb_buffers = lbm_gbl_config.output_buffers;
+    if (output->nb_buffers > 0) {
+        lbm_output_start_writer(output, rank);
+    }
+}
+
+/**
+ * @brief Copies the frame entries of the rank into a free snapshot buffer and
+ * hands it to the writer thread.
+ *
+ * @param output Output to write to.
+ * @param mesh_comm Rank-level communicator.
+ * @param mesh Local mesh to save.
+ **/
+static void lbm_output_snapshot(lbm_output_t* output,
+                                lbm_comm_t const* mesh_comm, Mesh const* mesh)
+{
+    // Back-pressure: wait for the writer thread to free the oldest buffer
+    double const before = MPI_Wtime();
+    pthread_mutex_lock(&output->lock);
+    while (output->nb_ready == output->nb_buffers) {
+        pthread_cond_wait(&output->free, &output->lock);
+    }
+    lbm_output_buffer_t* buffer =
+        &output->buffers[(output->head + output->nb_ready) %
+                         output->nb_buffers];
+    pthread_mutex_unlock(&output->lock);
+    output->stall_time += MPI_Wtime() - before;
+
+    // The writer thread only reads the buffers it was handed
+    lbm_output_fill(buffer, mesh_comm, mesh);
+    if (buffer->areas != NULL) {
+        lbm_output_fill_areas(buffer, mesh_comm);
+    }
+
+    pthread_mutex_lock(&output->lock);
+    output->nb_ready++;
+    pthread_cond_signal(&output->ready);
+    pthread_mutex_unlock(&output->lock);
+}
+
+void lbm_output_write_frame(lbm_output_t* output, lbm_comm_t const* mesh_comm,
+                            Mesh const* mesh)
+{
+    double const before = MPI_Wtime();
+    if (output->backend == OUTPUT_SERVERS) {
+        lbm_output_send(output, mesh_comm, mesh);
+        output->time += MPI_Wtime() - before;
+        return;
+    }
+    if (output->nb_buffers > 0) {
+        lbm_output_snapshot(output, mesh_comm, mesh);
+        output->time += MPI_Wtime() - before;
+        return;
+    }
+
+    lbm_output_buffer_t buffer = { 0 };
+    lbm_output_fill(&buffer, mesh_comm, mesh);
+    if (output->backend == OUTPUT_POSIX) {
+        // The master checksums and compresses the whole frame it assembles
+        if (output->frame != NULL) {
+            int comm_size;
+            MPI_Comm_size(mesh_comm->comm, &comm_size);
+            buffer.areas = malloc(4 * comm_size * sizeof(uint32_t));
+            if (buffer.areas == NULL) {
+                perror("malloc");
+                abort();
+            }
+            lbm_output_fill_areas(&buffer, mesh_comm);
+        }
+        lbm_output_gather(output, &buffer);
+    } else if (output->backend == OUTPUT_NODE) {
+        lbm_output_aggregate(output, &buffer);
+        lbm_output_record(output, &buffer);
+    } else {
+        lbm_output_write_area(output, buffer.entries, buffer.area);
+        lbm_output_record(output, &buffer);
+    }
+    free(buffer.entries);
+    free(buffer.areas);
+    output->nb_frames++;
+
+    // Synchronous writes are never hidden
+    double const elapsed = MPI_Wtime() - before;
+    output->time += elapsed;
+    output->stall_time += elapsed;
+    output->write_time += elapsed;
+}
+
+/**
+ * @brief Appends the index of the frames and the footer to the file, from the
+ * master or the first rank writing it.
+ *
+ * @param output Output to close, whose frames are all written.
+ **/
+static void lbm_output_write_index(lbm_output_t* output)
+{
+    int rank;
+    MPI_Comm_rank(output->comm, &rank);
+    if (output->backend != OUTPUT_POSIX) {
+        // Frames are raw, each rank only knows the checksums of its cells
+        lbm_output_reduce_checksums(output->index, output->nb_frames,
+                                    output->comm);
+        if (rank == 0) {
+            lbm_output_index_raw(output->index, output->nb_frames);
+        }
+        // Collective over the ranks opening the file, whose views only
+        // exposed their cells
+        if (output->file != MPI_FILE_NULL) {
+            MPI_File_set_view(output->file, 0, MPI_BYTE, MPI_BYTE, "native",
+                              MPI_INFO_NULL);
+        }
+    }
+    if (rank != 0) {
+        return;
+    }
+
+    size_t size;
+    uint8_t* footer = lbm_output_footer(output->index, output->nb_frames, &size);
+    if (output->backend == OUTPUT_POSIX) {
+        fwrite(footer, 1, size, output->fp);
+    } else {
+        MPI_File_write_at(output->file,
+                          sizeof(lbm_file_header_t) +
+                              (MPI_Offset)output->nb_frames * MESH_WIDTH *
+                                  MESH_HEIGHT * sizeof(lbm_file_entry_t),
+                          footer, size, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    free(footer);
+}
+
+void lbm_output_close(lbm_output_t* output)
+{
+    if (output->backend == OUTPUT_SERVERS) {
+        lbm_output_disconnect(output);
+    } else if (output->nb_buffers > 0) {
+        pthread_mutex_lock(&output->lock);
+        output->done = true;
+        pthread_cond_signal(&output->ready);
+        pthread_mutex_unlock(&output->lock);
+        pthread_join(output->writer, NULL);
+        pthread_mutex_destroy(&output->lock);
+        pthread_cond_destroy(&output->ready);
+        pthread_cond_destroy(&output->free);
+    }
+    if (output->backend != OUTPUT_SERVERS && RESULT_FILENAME != NULL) {
+        lbm_output_write_index(output);
+    }
+    for (uint32_t i = 0; i < output->nb_buffers; i++) {
+        free(output->buffers[i].entries);
+        free(output->buffers[i].areas);
+    }
+    free(output->buffers);
+    free(output->frame);
+    free(output->node_areas);
+    free(output->node_entries);
+    free(output->index);
+    if (output->codec != NULL) {
+        lbm_codec_release(output->codec);
+        free(output->codec);
+    }
+
+    if (output->fp != NULL) {
+        fclose(output->fp);
+    }
+    if (output->file != MPI_FILE_NULL) {
+        MPI_File_close(&output->file);
+    }
+    if (output->aggregators != MPI_COMM_NULL) {
+        MPI_Comm_free(&output->aggregators);
+    }
+    if (output->node_comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&output->node_comm);
+    }
+    if (output->comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&output->comm);
+    }
+    MPI_Type_free(&output->entry_type);
+}
@@ -12,10 +12,10 @@
 #if DIRECTIONS == 9 && DIMENSIONS == 2
 /// Definition of the 9 base vectors used to discretize the directions on each
 /// mesh.
-static double const direction_a[DIRECTIONS] = { 0.0, 1.0,  0.0,  -1.0, 0.0,
-                                                1.0, -1.0, -1.0, 1.0 };
-static double const direction_b[DIRECTIONS] = { 0.0, 0.0, 1.0,  0.0, -1.0,
-                                                1.0, 1.0, -1.0, -1.0 };
+double const direction_a[DIRECTIONS] = { 0.0, 1.0,  0.0,  -1.0, 0.0,
+                                         1.0, -1.0, -1.0, 1.0 };
+double const direction_b[DIRECTIONS] = { 0.0, 0.0, 1.0,  0.0, -1.0,
+                                         1.0, 1.0, -1.0, -1.0 };
 #else
     #error Need to defined adapted direction matrix.
 #endif
@@ -175,29 +175,77 @@ void compute_outflow_zou_he_const_density(lbm_mesh_cell_t cell)
     cell[7] = cell[5] + 0.5 * (cell[2] - cell[4]);
 }
 
+void special_cells_column(Mesh* mesh, lbm_mesh_type_t* mesh_type,
+                          lbm_comm_t const* mesh_comm, size_t i)
+{
+    special_cells_rows(mesh, mesh_type, mesh_comm, i, 1, mesh->height - 1);
+}
+
+void special_cells_rows(Mesh* mesh, lbm_mesh_type_t* mesh_type,
+                        lbm_comm_t const* mesh_comm, size_t i, size_t j_begin,
+                        size_t j_end)
+{
+    // Global position of the first row of the local mesh
+    size_t const y0 = mesh_comm->y + 1 - mesh_comm->ghost;
+    for (size_t j = j_begin; j < j_end; j++) {
+        switch (*(lbm_cell_type_t_get_cell(mesh_type, i, j))) {
+            case CELL_FUILD:
+                break;
+            case CELL_BOUNCE_BACK:
+                compute_bounce_back(Mesh_get_cell(mesh, i, j));
+                break;
+            case CELL_LEFT_IN:
+                compute_inflow_zou_he_poiseuille_distr(
+                    mesh, Mesh_get_cell(mesh, i, j), j + y0);
+                break;
+            case CELL_RIGHT_OUT:
+                compute_outflow_zou_he_const_density(
+                    Mesh_get_cell(mesh, i, j));
+                break;
+        }
+    }
+}
+
+void collision_column(Mesh* mesh_out, Mesh const* mesh_in, size_t i)
+{
+    collision_rows(mesh_out, mesh_in, i, 1, mesh_in->height - 1);
+}
+
+void collision_rows(Mesh* mesh_out, Mesh const* mesh_in, size_t i,
+                    size_t j_begin, size_t j_end)
+{
+    for (size_t j = j_begin; j < j_end; j++) {
+        compute_cell_collision(Mesh_get_cell(mesh_out, i, j),
+                               Mesh_get_cell(mesh_in, i, j));
+    }
+}
+
+void propagation_column(Mesh* mesh_out, Mesh const* mesh_in, size_t i)
+{
+    for (size_t k = 0; k < DIRECTIONS; k++) {
+        double dir_a = direction_a[k];
+        double dir_b = direction_b[k];
+        for (size_t j = 0; j < mesh_out->height; j++) {
+            // Compute destination point
+            ssize_t ii = (i + dir_a);
+            ssize_t jj = (j + dir_b);
+            // Propagate to neighboor nodes
+            if ((ii >= 0 && ii < mesh_out->width) &&
+                (jj >= 0 && jj < mesh_out->height)) {
+                Mesh_get_cell(mesh_out, ii, jj)[k] =
+                    Mesh_get_cell(mesh_in, i, j)[k];
+            }
+        }
+    }
+}
+
 void special_cells(Mesh* mesh, lbm_mesh_type_t* mesh_type,
                    lbm_comm_t const* mesh_comm)
 {
 // Loop on all inner cells
 #pragma omp for schedule(static)
     for (size_t i = 1; i < mesh->width - 1; i++) {
-        for (size_t j = 1; j < mesh->height - 1; j++) {
-            switch (*(lbm_cell_type_t_get_cell(mesh_type, i, j))) {
-                case CELL_FUILD:
-                    break;
-                case CELL_BOUNCE_BACK:
-                    compute_bounce_back(Mesh_get_cell(mesh, i, j));
-                    break;
-                case CELL_LEFT_IN:
-                    compute_inflow_zou_he_poiseuille_distr(
-                        mesh, Mesh_get_cell(mesh, i, j), j + mesh_comm->y);
-                    break;
-                case CELL_RIGHT_OUT:
-                    compute_outflow_zou_he_const_density(
-                        Mesh_get_cell(mesh, i, j));
-                    break;
-            }
-        }
+        special_cells_column(mesh, mesh_type, mesh_comm, i);
     }
 }
 
@@ -206,10 +254,7 @@ void collision(Mesh* mesh_out, const Mesh* mesh_in)
 // Loop on all inner cells
 #pragma omp for schedule(static)
     for (size_t i = 1; i < mesh_in->width - 1; i++) {
-        for (size_t j = 1; j < mesh_in->height - 1; j++) {
-            compute_cell_collision(Mesh_get_cell(mesh_out, i, j),
-                                   Mesh_get_cell(mesh_in, i, j));
-        }
+        collision_column(mesh_out, mesh_in, i);
     }
 }
 
@@ -218,20 +263,63 @@ void propagation(Mesh* mesh_out, Mesh const* mesh_in)
 // Loop on all cells
 #pragma omp for schedule(static)
     for (size_t i = 0; i < mesh_out->width; i++) {
-        for (size_t k = 0; k < DIRECTIONS; k++) {
-            double dir_a = direction_a[k];
-            double dir_b = direction_b[k];
-            for (size_t j = 0; j < mesh_out->height; j++) {
-                // Compute destination point
-                ssize_t ii = (i + dir_a);
-                ssize_t jj = (j + dir_b);
-                // Propagate to neighboor nodes
-                if ((ii >= 0 && ii < mesh_out->width) &&
-                    (jj >= 0 && jj < mesh_out->height)) {
-                    Mesh_get_cell(mesh_out, ii, jj)[k] =
-                        Mesh_get_cell(mesh_in, i, j)[k];
-                }
-            }
-        }
+        propagation_column(mesh_out, mesh_in, i);
+    }
+}
+
+void collision_boundaries(Mesh* mesh_out, Mesh* mesh_in,
+                          lbm_mesh_type_t* mesh_type,
+                          lbm_comm_t const* mesh_comm)
+{
+    size_t const last = mesh_in->width - 2;
+
+    #pragma omp single nowait
+    {
+        special_cells_column(mesh_in, mesh_type, mesh_comm, 1);
+        collision_column(mesh_out, mesh_in, 1);
+    }
+    #pragma omp single
+    if (last != 1) {
+        special_cells_column(mesh_in, mesh_type, mesh_comm, last);
+        collision_column(mesh_out, mesh_in, last);
+    }
+}
+
+void collision_inner(Mesh* mesh_out, Mesh* mesh_in,
+                     lbm_mesh_type_t* mesh_type, lbm_comm_t const* mesh_comm)
+{
+// Loop on inner cells, boundary columns excluded
+#pragma omp for schedule(static)
+    for (size_t i = 2; i < mesh_in->width - 2; i++) {
+        special_cells_column(mesh_in, mesh_type, mesh_comm, i);
+        collision_column(mesh_out, mesh_in, i);
     }
 }
+
+void collision_region(Mesh* mesh_out, Mesh* mesh_in,
+                      lbm_mesh_type_t* mesh_type, lbm_comm_t const* mesh_comm,
+                      lbm_region_t const* region)
+{
+// Loop on the columns of the region
+#pragma omp for schedule(static)
+    for (size_t i = region->x_begin; i < region->x_end; i++) {
+        special_cells_rows(mesh_in, mesh_type, mesh_comm, i, region->y_begin,
+                           region->y_end);
+        collision_rows(mesh_out, mesh_in, i, region->y_begin, region->y_end);
+    }
+}
+
+void propagation_inner(Mesh* mesh_out, Mesh const* mesh_in)
+{
+// Loop on inner cells, no barrier as the ghost columns write elsewhere
+#pragma omp for schedule(static) nowait
+    for (size_t i = 1; i < mesh_out->width - 1; i++) {
+        propagation_column(mesh_out, mesh_in, i);
+    }
+}
+
+void propagation_ghosts(Mesh* mesh_out, Mesh const* mesh_in)
+{
+    propagation_column(mesh_out, mesh_in, 0);
+    propagation_column(mesh_out, mesh_in, mesh_out->width - 1);
+}
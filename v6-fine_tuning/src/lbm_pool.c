@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include "lbm_pool.h"
+
+#include "lbm_phys.h"
+
+#include <mpi.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Arguments of a worker thread.
+ **/
+typedef struct lbm_pool_worker_s {
+    lbm_pool_t* pool;
+    int tid;
+} lbm_pool_worker_t;
+
+/**
+ * @brief Selects the `index`-th CPU allowed for the process.
+ **/
+static void lbm_pool_select_cpu(int index, cpu_set_t const* allowed,
+                                cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    int target = index % CPU_COUNT(allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, allowed) && target-- == 0) {
+            CPU_SET(cpu, set);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Index of the first CPU to use for the pool of the calling rank.
+ *
+ * When the rank was not bound to as many cores as it has threads by the MPI
+ * launcher, ranks sharing a node are spread on distinct cores.
+ **/
+static int lbm_pool_first_cpu(MPI_Comm comm, int nb_threads,
+                              cpu_set_t const* allowed)
+{
+    MPI_Comm node_comm;
+    int local_rank;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0,
+                        MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &local_rank);
+    MPI_Comm_free(&node_comm);
+
+    return (CPU_COUNT(allowed) > nb_threads) ? local_rank * nb_threads : 0;
+}
+
+/**
+ * @brief Work of one thread during a time step.
+ **/
+static void lbm_pool_work(lbm_pool_t* pool, int tid)
+{
+    Mesh* mesh = pool->mesh;
+    Mesh* temp = pool->temp;
+
+    // Fixed static partition of the columns
+    size_t const inner_width = mesh->width - 2;
+    size_t const begin = 1 + tid * inner_width / pool->nb_threads;
+    size_t const end = 1 + (tid + 1) * inner_width / pool->nb_threads;
+
+    // Compute special actions and collision term
+    for (size_t i = begin; i < end; i++) {
+        special_cells_column(mesh, pool->mesh_type, pool->mesh_comm, i);
+        collision_column(temp, mesh, i);
+    }
+    lbm_barrier_wait(&pool->barrier);
+
+    // Exchange ghost cells
+    if (tid == 0) {
+        lbm_comm_ghost_exchange(pool->mesh_comm, temp);
+    }
+    lbm_barrier_wait(&pool->barrier);
+
+    // Propagate values from node to neighboors, ghost columns included
+    // Threads without columns must not take the ghost columns too
+    size_t const first = (begin == 1 && begin < end) ? 0 : begin;
+    size_t const last =
+        (end == mesh->width - 1 && begin < end) ? mesh->width : end;
+    for (size_t i = first; i < last; i++) {
+        propagation_column(mesh, temp, i);
+    }
+}
+
+static void* lbm_pool_worker_main(void* arg)
+{
+    lbm_pool_worker_t const worker = *(lbm_pool_worker_t*)arg;
+    free(arg);
+
+    for (;;) {
+        // Wait for a step
+        lbm_barrier_wait(&worker.pool->barrier);
+        if (!atomic_load_explicit(&worker.pool->running,
+                                  memory_order_acquire)) {
+            break;
+        }
+        lbm_pool_work(worker.pool, worker.tid);
+        // Signal the end of the step
+        lbm_barrier_wait(&worker.pool->barrier);
+    }
+
+    return NULL;
+}
+
+void lbm_pool_init(lbm_pool_t* pool, MPI_Comm comm, int nb_threads)
+{
+    if (nb_threads < 1) {
+        fatal("The thread pool needs at least one thread.");
+    }
+
+    pool->nb_threads = nb_threads;
+    lbm_barrier_init(&pool->barrier, nb_threads);
+    atomic_init(&pool->running, true);
+
+    pool->threads = malloc((nb_threads - 1) * sizeof(pthread_t));
+    if (pool->threads == NULL && nb_threads > 1) {
+        perror("malloc");
+        abort();
+    }
+
+    // Pin the threads on the CPUs given to the rank, the calling thread
+    // included as thread 0 until the pool is released
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed);
+    pool->affinity = allowed;
+    int const first_cpu = lbm_pool_first_cpu(comm, nb_threads, &allowed);
+    cpu_set_t set;
+    lbm_pool_select_cpu(first_cpu, &allowed, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    for (int t = 1; t < nb_threads; t++) {
+        lbm_pool_worker_t* worker = malloc(sizeof(lbm_pool_worker_t));
+        if (worker == NULL) {
+            perror("malloc");
+            abort();
+        }
+        worker->pool = pool;
+        worker->tid = t;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        lbm_pool_select_cpu(first_cpu + t, &allowed, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        if (pthread_create(&pool->threads[t - 1], &attr, lbm_pool_worker_main,
+                           worker) != 0) {
+            fatal("Failed to create a worker thread.");
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+void lbm_pool_release(lbm_pool_t* pool)
+{
+    // Wake the workers up one last time so they exit
+    atomic_store_explicit(&pool->running, false, memory_order_release);
+    lbm_barrier_wait(&pool->barrier);
+
+    for (int t = 1; t < pool->nb_threads; t++) {
+        pthread_join(pool->threads[t - 1], NULL);
+    }
+    free(pool->threads);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(pool->affinity),
+                           &pool->affinity);
+}
+
+void lbm_pool_step(lbm_pool_t* pool, Mesh* mesh, Mesh* temp,
+                   lbm_mesh_type_t* mesh_type, lbm_comm_t* mesh_comm)
+{
+    pool->mesh = mesh;
+    pool->temp = temp;
+    pool->mesh_type = mesh_type;
+    pool->mesh_comm = mesh_comm;
+
+    // Start the step, the barrier publishes the step data to the workers
+    lbm_barrier_wait(&pool->barrier);
+    lbm_pool_work(pool, 0);
+    lbm_barrier_wait(&pool->barrier);
+}
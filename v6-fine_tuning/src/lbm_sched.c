@@ -0,0 +1,322 @@
+#include "lbm_sched.h"
+
+#include "lbm_phys.h"
+
+#include <omp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/// Returned by the deque operations when there is nothing to take.
+#define DEQUE_EMPTY -1
+/// Returned by a steal when it lost a race and should be retried.
+#define DEQUE_ABORT -2
+
+/**
+ * @brief Phases of a time step scheduled by chunks of columns.
+ **/
+typedef enum lbm_sched_phase_e {
+    /// Special actions and collision (inner columns).
+    PHASE_COLLIDE,
+    /// Propagation (all columns).
+    PHASE_PROPAGATE
+} lbm_sched_phase_t;
+
+/**
+ * @brief Data shared by the threads during a time step.
+ **/
+typedef struct lbm_sched_step_s {
+    Mesh* mesh;
+    Mesh* temp;
+    lbm_mesh_type_t* mesh_type;
+    lbm_comm_t const* mesh_comm;
+    lbm_sched_phase_t phase;
+    /// First column of the phase.
+    size_t first;
+    /// Last column (excluded) of the phase.
+    size_t last;
+} lbm_sched_step_t;
+
+static void lbm_deque_reset(lbm_deque_t* deque)
+{
+    atomic_store_explicit(&deque->top, 0, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, 0, memory_order_relaxed);
+}
+
+static void lbm_deque_push(lbm_deque_t* deque, uint32_t chunk)
+{
+    long const b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    atomic_store_explicit(&deque->chunks[b % deque->capacity], chunk,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+}
+
+static long lbm_deque_pop(lbm_deque_t* deque)
+{
+    long const b =
+        atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        // Empty
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return DEQUE_EMPTY;
+    }
+
+    long chunk = atomic_load_explicit(&deque->chunks[b % deque->capacity],
+                                      memory_order_relaxed);
+    if (t == b) {
+        // Last chunk, race against thieves
+        if (!atomic_compare_exchange_strong_explicit(
+                &deque->top, &t, t + 1, memory_order_seq_cst,
+                memory_order_relaxed)) {
+            chunk = DEQUE_EMPTY;
+        }
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+    return chunk;
+}
+
+static long lbm_deque_steal(lbm_deque_t* deque)
+{
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long const b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return DEQUE_EMPTY;
+    }
+
+    long const chunk = atomic_load_explicit(
+        &deque->chunks[t % deque->capacity], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return DEQUE_ABORT;
+    }
+    return chunk;
+}
+
+void lbm_sched_init(lbm_sched_t* sched, lbm_sched_policy_t policy,
+                    int nb_threads, uint32_t chunk_size, uint32_t width)
+{
+    if (chunk_size == 0) {
+        fatal("Chunks must contain at least one column.");
+    }
+
+    sched->policy = policy;
+    sched->nb_threads = nb_threads;
+    sched->chunk_size = chunk_size;
+
+    sched->deques = aligned_alloc(CACHE_LINE_SIZE,
+                                  nb_threads * sizeof(lbm_deque_t));
+    sched->stats = aligned_alloc(CACHE_LINE_SIZE,
+                                 nb_threads * sizeof(lbm_thread_stats_t));
+    if (sched->deques == NULL || sched->stats == NULL) {
+        perror("aligned_alloc");
+        abort();
+    }
+
+    long const capacity = (width + chunk_size - 1) / chunk_size;
+    for (int t = 0; t < nb_threads; t++) {
+        lbm_deque_t* deque = &sched->deques[t];
+        atomic_init(&deque->top, 0);
+        atomic_init(&deque->bottom, 0);
+        deque->capacity = capacity;
+        deque->chunks = malloc(capacity * sizeof(atomic_uint));
+        if (deque->chunks == NULL) {
+            perror("malloc");
+            abort();
+        }
+
+        sched->stats[t] = (lbm_thread_stats_t){ 0 };
+    }
+}
+
+void lbm_sched_release(lbm_sched_t* sched)
+{
+    for (int t = 0; t < sched->nb_threads; t++) {
+        free(sched->deques[t].chunks);
+    }
+    free(sched->deques);
+    free(sched->stats);
+}
+
+/**
+ * @brief Computes every column of a chunk for the current phase.
+ **/
+static void lbm_sched_run_chunk(lbm_sched_t const* sched,
+                                lbm_sched_step_t const* step, uint32_t chunk)
+{
+    size_t const begin = step->first + (size_t)chunk * sched->chunk_size;
+    size_t end = begin + sched->chunk_size;
+    if (end > step->last) {
+        end = step->last;
+    }
+
+    switch (step->phase) {
+        case PHASE_COLLIDE:
+            for (size_t i = begin; i < end; i++) {
+                special_cells_column(step->mesh, step->mesh_type,
+                                     step->mesh_comm, i);
+                collision_column(step->temp, step->mesh, i);
+            }
+            break;
+        case PHASE_PROPAGATE:
+            for (size_t i = begin; i < end; i++) {
+                propagation_column(step->mesh, step->temp, i);
+            }
+            break;
+    }
+}
+
+/**
+ * @brief Tries to steal a chunk from the other threads, starting at a random
+ * victim.
+ *
+ * @return The stolen chunk or `DEQUE_EMPTY` if every deque is empty.
+ **/
+static long lbm_sched_steal(lbm_sched_t* sched, int tid, uint32_t* seed)
+{
+    bool retry = true;
+    while (retry) {
+        retry = false;
+        // Xorshift to pick the first victim
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 17;
+        *seed ^= *seed << 5;
+        int const first = *seed % sched->nb_threads;
+
+        for (int v = 0; v < sched->nb_threads; v++) {
+            int const victim = (first + v) % sched->nb_threads;
+            if (victim == tid) {
+                continue;
+            }
+            long const chunk = lbm_deque_steal(&sched->deques[victim]);
+            if (chunk >= 0) {
+                return chunk;
+            }
+            if (chunk == DEQUE_ABORT) {
+                retry = true;
+            }
+        }
+    }
+    return DEQUE_EMPTY;
+}
+
+/**
+ * @brief Runs one phase of a time step on the calling thread, ending with a
+ * barrier.
+ **/
+static void lbm_sched_run_phase(lbm_sched_t* sched,
+                                lbm_sched_step_t const* step)
+{
+    int const tid = omp_get_thread_num();
+    lbm_thread_stats_t* stats = &sched->stats[tid];
+
+    // Static partition of the chunks
+    uint32_t const nb_chunks =
+        (step->last - step->first + sched->chunk_size - 1) / sched->chunk_size;
+    uint32_t const begin = tid * nb_chunks / sched->nb_threads;
+    uint32_t const end = (tid + 1) * nb_chunks / sched->nb_threads;
+
+    if (sched->policy == SCHED_STEALING) {
+        // Owner pops from the bottom, so push in reverse order to keep
+        // computing contiguous columns
+        lbm_deque_t* deque = &sched->deques[tid];
+        lbm_deque_reset(deque);
+        for (uint32_t c = end; c > begin; c--) {
+            lbm_deque_push(deque, c - 1);
+        }
+        #pragma omp barrier
+    }
+
+    double const phase_before = omp_get_wtime();
+    double busy = 0.0;
+
+    if (sched->policy == SCHED_STEALING) {
+        uint32_t seed = 2463534242u + tid * 7919u;
+        for (;;) {
+            // Own chunks first, then other threads' ones
+            bool stolen = false;
+            long chunk = lbm_deque_pop(&sched->deques[tid]);
+            if (chunk == DEQUE_EMPTY) {
+                chunk = lbm_sched_steal(sched, tid, &seed);
+                stolen = true;
+            }
+            if (chunk == DEQUE_EMPTY) {
+                break;
+            }
+
+            double const before = omp_get_wtime();
+            lbm_sched_run_chunk(sched, step, chunk);
+            busy += omp_get_wtime() - before;
+            stats->chunks++;
+            stats->stolen += stolen;
+        }
+    } else {
+        double const before = omp_get_wtime();
+        for (uint32_t c = begin; c < end; c++) {
+            lbm_sched_run_chunk(sched, step, c);
+        }
+        busy += omp_get_wtime() - before;
+        stats->chunks += end - begin;
+    }
+
+    #pragma omp barrier
+    stats->busy += busy;
+    stats->idle += omp_get_wtime() - phase_before - busy;
+}
+
+void lbm_sched_step(lbm_sched_t* sched, Mesh* mesh, Mesh* temp,
+                    lbm_mesh_type_t* mesh_type, lbm_comm_t* mesh_comm)
+{
+    lbm_sched_step_t step = {
+        .mesh = mesh,
+        .temp = temp,
+        .mesh_type = mesh_type,
+        .mesh_comm = mesh_comm,
+        .phase = PHASE_COLLIDE,
+        .first = 1,
+        .last = mesh->width - 1,
+    };
+
+    // Compute special actions and collision term
+    lbm_sched_run_phase(sched, &step);
+
+    // Exchange ghost cells
+    #pragma omp master
+    lbm_comm_ghost_exchange(mesh_comm, temp);
+    #pragma omp barrier
+
+    // Propagate values from node to neighboors
+    step.phase = PHASE_PROPAGATE;
+    step.first = 0;
+    step.last = mesh->width;
+    lbm_sched_run_phase(sched, &step);
+}
+
+void lbm_sched_print_stats(lbm_sched_t const* sched, int rank)
+{
+    double max_busy = 0.0, sum_busy = 0.0, sum_idle = 0.0;
+    for (int t = 0; t < sched->nb_threads; t++) {
+        lbm_thread_stats_t const* stats = &sched->stats[t];
+        printf("\033[1mRank \033[33m%d\033[0m: thread %3d: busy %.6lfs, idle "
+               "%.6lfs, %lu chunks (%lu stolen)\n",
+               rank, t, stats->busy, stats->idle, stats->chunks,
+               stats->stolen);
+        max_busy = (stats->busy > max_busy) ? stats->busy : max_busy;
+        sum_busy += stats->busy;
+        sum_idle += stats->idle;
+    }
+
+    double const avg_busy = sum_busy / sched->nb_threads;
+    printf("\033[1mRank \033[33m%d\033[0m: %s scheduling imbalance (max/avg "
+           "busy): \033[36m%.3lf\033[0m, idle ratio: \033[36m%.2lf%%\033[0m\n",
+           rank, (sched->policy == SCHED_STEALING) ? "work-stealing" : "static",
+           (avg_busy > 0.0) ? max_busy / avg_busy : 1.0,
+           100.0 * sum_idle / (sum_busy + sum_idle));
+}
@@ -0,0 +1,293 @@
+#include "lbm_subdomain.h"
+
+#include "lbm_init.h"
+#include "lbm_phys.h"
+
+#include <mpi.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+void lbm_subdomain_split(lbm_subdomain_t* subdomain,
+                         lbm_comm_t const* mesh_comm, int id, int count)
+{
+    int rank;
+    MPI_Comm_rank(mesh_comm->comm, &rank);
+
+    // Near-equal split of the inner columns of the local domain
+    uint32_t const inner_width = mesh_comm->width - 2;
+    if (inner_width < (uint32_t)count) {
+        fatal("Not enough columns to give each subdomain one.");
+    }
+    uint32_t const begin = id * inner_width / count;
+    uint32_t const end = (id + 1) * inner_width / count;
+
+    // Copy rank-level description then narrow it down
+    subdomain->comm = *mesh_comm;
+    subdomain->comm.x = mesh_comm->x + begin;
+    subdomain->comm.width = end - begin + 2;
+
+    // Inner neighbours are threads of the current rank
+    subdomain->left_tid = (id > 0) ? id - 1 : -1;
+    subdomain->right_tid = (id < count - 1) ? id + 1 : -1;
+    if (subdomain->left_tid != -1) {
+        subdomain->comm.left_id = rank;
+    }
+    if (subdomain->right_tid != -1) {
+        subdomain->comm.right_id = rank;
+    }
+
+    // Messages to other ranks are posted by the subdomain itself
+    subdomain->comm.backend = HALO_P2P;
+    subdomain->comm.nb_peers = 0;
+    subdomain->comm.nb_requests = 0;
+    subdomain->comm.messages_sent = 0;
+    subdomain->comm.bytes_sent = 0;
+    subdomain->comm.wait_time = 0.0;
+}
+
+void lbm_subdomain_init(lbm_subdomain_t* subdomain)
+{
+    lbm_comm_t const* comm = &subdomain->comm;
+
+    Mesh_init(&subdomain->mesh, lbm_comm_width(comm), lbm_comm_height(comm));
+    Mesh_init(&subdomain->temp, lbm_comm_width(comm), lbm_comm_height(comm));
+    lbm_mesh_type_t_init(&subdomain->mesh_type, lbm_comm_width(comm),
+                         lbm_comm_height(comm));
+
+    setup_init_state(&subdomain->mesh, &subdomain->mesh_type, comm);
+    setup_init_state_copy(&subdomain->temp, &subdomain->mesh);
+}
+
+void lbm_subdomain_release(lbm_subdomain_t* subdomain)
+{
+    Mesh_release(&subdomain->mesh);
+    Mesh_release(&subdomain->temp);
+    lbm_mesh_type_t_release(&subdomain->mesh_type);
+}
+
+/**
+ * @brief Exchanges one ghost column with the neighbouring rank, restricted to
+ * the populations crossing the shared side.
+ *
+ * @param comm Communicator of the subdomain.
+ * @param temp Mesh to update.
+ * @param target_rank Rank to communicate with.
+ * @param send_x X coordinate of the column to send.
+ * @param recv_x X coordinate of the ghost column to receive.
+ * @param side Side of the subdomain shared with the neighbour.
+ **/
+static void lbm_subdomain_sync_ghosts_remote(lbm_comm_t* comm, Mesh* temp,
+                                             int target_rank, uint32_t send_x,
+                                             uint32_t recv_x, lbm_side_t side)
+{
+    MPI_Datatype const send_type = comm->side_types[side];
+    MPI_Datatype const recv_type =
+        comm->side_types[(side == SIDE_LEFT) ? SIDE_RIGHT : SIDE_LEFT];
+
+    MPI_Status status;
+    MPI_Sendrecv(Mesh_get_col(temp, send_x), 1, send_type, target_rank, 0,
+                 Mesh_get_col(temp, recv_x), 1, recv_type, target_rank, 0,
+                 comm->comm, &status);
+
+    int size;
+    MPI_Type_size(send_type, &size);
+    comm->messages_sent++;
+    comm->bytes_sent += size;
+}
+
+/**
+ * @brief Reads one ghost column from a neighbouring subdomain of the same
+ * rank.
+ *
+ * @param temp Mesh to update.
+ * @param recv_x X coordinate of the ghost column to fill.
+ * @param neighbour Mesh of the neighbouring subdomain.
+ * @param send_x X coordinate of the column to read in the neighbour.
+ **/
+static void lbm_subdomain_sync_ghosts_local(Mesh* temp, uint32_t recv_x,
+                                            Mesh const* neighbour,
+                                            uint32_t send_x)
+{
+    memcpy(Mesh_get_col(temp, recv_x), Mesh_get_col(neighbour, send_x),
+           DIRECTIONS * (temp->height - 2) * sizeof(double));
+}
+
+void lbm_subdomain_ghost_exchange(lbm_subdomain_t* subdomains, int id)
+{
+    lbm_subdomain_t* subdomain = &subdomains[id];
+    Mesh* temp = &subdomain->temp;
+
+    // Left side
+    if (subdomain->left_tid != -1) {
+        Mesh const* left = &subdomains[subdomain->left_tid].temp;
+        lbm_subdomain_sync_ghosts_local(temp, 0, left, left->width - 2);
+    } else if (subdomain->comm.left_id != -1) {
+        lbm_subdomain_sync_ghosts_remote(&subdomain->comm, temp,
+                                         subdomain->comm.left_id, 1, 0,
+                                         SIDE_LEFT);
+    }
+
+    // Right side
+    if (subdomain->right_tid != -1) {
+        Mesh const* right = &subdomains[subdomain->right_tid].temp;
+        lbm_subdomain_sync_ghosts_local(temp, temp->width - 1, right, 1);
+    } else if (subdomain->comm.right_id != -1) {
+        lbm_subdomain_sync_ghosts_remote(&subdomain->comm, temp,
+                                         subdomain->comm.right_id,
+                                         temp->width - 2, temp->width - 1,
+                                         SIDE_RIGHT);
+    }
+}
+
+/**
+ * @brief Computes special actions and collision term on the owned columns of
+ * a subdomain.
+ *
+ * @param subdomain Subdomain to compute.
+ **/
+static void lbm_subdomain_collide(lbm_subdomain_t* subdomain)
+{
+    Mesh* mesh = &subdomain->mesh;
+    for (size_t i = 1; i < mesh->width - 1; i++) {
+        special_cells_column(mesh, &subdomain->mesh_type, &subdomain->comm, i);
+        collision_column(&subdomain->temp, mesh, i);
+    }
+}
+
+/**
+ * @brief Propagates the populations of a subdomain, ghost columns included.
+ *
+ * @param subdomain Subdomain to compute.
+ **/
+static void lbm_subdomain_propagate(lbm_subdomain_t* subdomain)
+{
+    Mesh* mesh = &subdomain->mesh;
+    for (size_t i = 0; i < mesh->width; i++) {
+        propagation_column(mesh, &subdomain->temp, i);
+    }
+}
+
+void lbm_subdomain_step(lbm_subdomain_t* subdomains, int id)
+{
+    lbm_subdomain_collide(&subdomains[id]);
+
+    // Neighbours must be done colliding before reading their columns
+    #pragma omp barrier
+    lbm_subdomain_ghost_exchange(subdomains, id);
+    // Neighbours must be done reading before `temp` is modified again
+    #pragma omp barrier
+
+    // Propagate values from node to neighboors
+    lbm_subdomain_propagate(&subdomains[id]);
+}
+
+/**
+ * @brief Posts the non-blocking exchange of the ghost columns shared with
+ * other ranks, completed by `lbm_subdomain_wait_remote`.
+ *
+ * @param block Block on the edge of the rank.
+ **/
+static void lbm_subdomain_post_remote(lbm_subdomain_t* block)
+{
+    lbm_comm_t* comm = &block->comm;
+    Mesh* temp = &block->temp;
+
+    // Receives are posted first so that messages land directly in place
+    if (block->left_tid == -1) {
+        lbm_comm_sync_ghosts_horizontal(comm, temp, COMM_RECV, comm->left_id,
+                                        0, SIDE_RIGHT);
+    }
+    if (block->right_tid == -1) {
+        lbm_comm_sync_ghosts_horizontal(comm, temp, COMM_RECV, comm->right_id,
+                                        temp->width - 1, SIDE_LEFT);
+    }
+    if (block->left_tid == -1) {
+        lbm_comm_sync_ghosts_horizontal(comm, temp, COMM_SEND, comm->left_id,
+                                        1, SIDE_LEFT);
+    }
+    if (block->right_tid == -1) {
+        lbm_comm_sync_ghosts_horizontal(comm, temp, COMM_SEND, comm->right_id,
+                                        temp->width - 2, SIDE_RIGHT);
+    }
+}
+
+/**
+ * @brief Completes the exchange posted by `lbm_subdomain_post_remote`.
+ *
+ * @param block Block on the edge of the rank.
+ **/
+static void lbm_subdomain_wait_remote(lbm_subdomain_t* block)
+{
+    lbm_comm_t* comm = &block->comm;
+    double const before = MPI_Wtime();
+    MPI_Waitall(comm->nb_requests, comm->requests, MPI_STATUSES_IGNORE);
+    comm->wait_time += MPI_Wtime() - before;
+    comm->nb_requests = 0;
+}
+
+/**
+ * @brief Order in which the blocks are collided: the two blocks on the edges
+ * of the rank first, then the inner ones.
+ *
+ * @param k Position in the order.
+ * @param count Number of blocks.
+ * @return ID of the block.
+ **/
+static int lbm_subdomain_block_order(int k, int count)
+{
+    if (k == 0) {
+        return 0;
+    }
+    if (k == 1) {
+        return count - 1;
+    }
+    return k - 1;
+}
+
+void lbm_subdomain_blocks_step(lbm_subdomain_t* blocks, int count)
+{
+    // Halos of the edge blocks are sent as soon as they collided, the inner
+    // blocks are computed meanwhile
+    #pragma omp for schedule(dynamic, 1)
+    for (int k = 0; k < count; k++) {
+        int const id = lbm_subdomain_block_order(k, count);
+        lbm_subdomain_collide(&blocks[id]);
+        if (blocks[id].left_tid == -1 || blocks[id].right_tid == -1) {
+            lbm_subdomain_post_remote(&blocks[id]);
+        }
+    }
+
+    // Every block collided: ghost columns are only written by their owner and
+    // neighbours only read owned columns. Edge blocks come last to leave time
+    // to their messages.
+    #pragma omp for schedule(dynamic, 1)
+    for (int k = count - 1; k >= 0; k--) {
+        int const id = lbm_subdomain_block_order(k, count);
+        lbm_subdomain_t* block = &blocks[id];
+        if (block->left_tid != -1) {
+            Mesh const* left = &blocks[block->left_tid].temp;
+            lbm_subdomain_sync_ghosts_local(&block->temp, 0, left,
+                                            left->width - 2);
+        }
+        if (block->right_tid != -1) {
+            lbm_subdomain_sync_ghosts_local(&block->temp,
+                                            block->temp.width - 1,
+                                            &blocks[block->right_tid].temp, 1);
+        }
+        if (block->left_tid == -1 || block->right_tid == -1) {
+            lbm_subdomain_wait_remote(block);
+        }
+        lbm_subdomain_propagate(block);
+    }
+}
+
+void lbm_subdomain_gather(Mesh* mesh, lbm_comm_t const* mesh_comm,
+                          lbm_subdomain_t const* subdomain)
+{
+    uint32_t const offset = subdomain->comm.x - mesh_comm->x;
+    memcpy(Mesh_get_cell(mesh, offset + 1, 0),
+           Mesh_get_cell(&subdomain->mesh, 1, 0),
+           (subdomain->mesh.width - 2) * mesh->height * DIRECTIONS *
+               sizeof(double));
+}
@@ -1,8 +1,14 @@
+#include "lbm_balance.h"
 #include "lbm_comm.h"
+#include "lbm_comm_thread.h"
 #include "lbm_config.h"
 #include "lbm_init.h"
+#include "lbm_output.h"
 #include "lbm_phys.h"
+#include "lbm_pool.h"
+#include "lbm_sched.h"
 #include "lbm_struct.h"
+#include "lbm_subdomain.h"
 
 #include <assert.h>
 #include <math.h>
@@ -15,97 +21,42 @@
 #include <time.h>
 
 /**
- * @brief Writes the output file's header.
- * It essentialy provides information on the size of the mesh.
+ * @brief Computes the macroscopic quantities of one local mesh of a step.
  *
- * @param fp File descriptor to write to.
- * @param mesh_comm Domain to save.
- **/
-static void write_file_header(FILE* fp, lbm_comm_t* mesh_comm)
-{
-    // Setup header values
-    lbm_file_header_t header = {
-        .magick = RESULT_MAGICK,
-        .mesh_height = MESH_HEIGHT,
-        .mesh_width = MESH_WIDTH,
-        .lines = mesh_comm->nb_y,
-    };
-
-    // Write file
-    fwrite(&header, sizeof(header), 1, fp);
-}
-
-/**
- * @brief Opens the output file's header in write mode.
+ * This function is called by every rank when assembling a frame of the whole
+ * domain, before sending its part to the master. Writes only velocities and
+ * macroscopic densities of the owned cells in the form of single precision
+ * floating-point numbers, in column-major order.
  *
- * @return File descriptor to write to.
+ * @param entries First entry of the first owned column.
+ * @param stride Number of entries between the first cells of two columns.
+ * @param mesh Local mesh to save.
+ * @param ghost Number of phantom layers of the mesh.
  **/
-static FILE* open_output_file()
+void fill_frame(lbm_file_entry_t* entries, size_t stride, Mesh const* mesh,
+                uint32_t ghost)
 {
-    // No output if empty filename
-    if (RESULT_FILENAME == NULL) {
-        return NULL;
-    }
-
-    // Open result file
-    FILE* fp = fopen(RESULT_FILENAME, "wb");
-    if (fp == NULL) {
-        perror(RESULT_FILENAME);
-        abort();
-    }
-
-    return fp;
-}
-
-static inline void close_file(FILE* fp)
-{
-    fclose(fp);
-}
-
-/**
- * @brief Saves the result of one step of computation.
- *
- * This function can be called multiple times when a MPI save on multiple
- * processes happens (e.g. saving them one at a time on each domain).
- * Writes only velocities and macroscopic densities in the form of single
- * precision floating-point numbers.
- *
- * @param fp File descriptor to write to.
- * @param mesh Domain to save.
- **/
-void save_frame(FILE* fp, const Mesh* mesh)
-{
-    // Write buffer to write float instead of double
-    lbm_file_entry_t buffer[WRITE_BUFFER_ENTRIES];
+    uint32_t const width = mesh->width - 2 * ghost;
+    uint32_t const height = mesh->height - 2 * ghost;
 
     // Loop on all values
-    size_t cnt = 0;
-    for (size_t i = 1; i < mesh->width - 1; i++) {
-        for (size_t j = 1; j < mesh->height - 1; j++) {
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < width; i++) {
+        lbm_file_entry_t* column = &entries[i * stride];
+        for (size_t j = 0; j < height; j++) {
             // Compute macroscopic values
-            double const density = get_cell_density(Mesh_get_cell(mesh, i, j));
+            lbm_mesh_cell_t const cell =
+                Mesh_get_cell(mesh, i + ghost, j + ghost);
+            double const density = get_cell_density(cell);
             Vector v;
-            get_cell_velocity(v, Mesh_get_cell(mesh, i, j), density);
+            get_cell_velocity(v, cell, density);
             double const norm = sqrt(get_vect_norm_2(v, v));
 
-            // Fill buffer
-            buffer[cnt].rho = density;
-            buffer[cnt].v = norm;
-            cnt++;
-            assert(cnt <= WRITE_BUFFER_ENTRIES);
-
-            // Flush buffer if full
-            if (cnt == WRITE_BUFFER_ENTRIES) {
-                fwrite(buffer, sizeof(lbm_file_entry_t), cnt, fp);
-                cnt = 0;
-            }
+            // Fill frame
+            column[j].rho = density;
+            column[j].v = norm;
         }
     }
-
-    // Final flush
-    if (cnt != 0) {
-        fwrite(buffer, sizeof(lbm_file_entry_t), cnt, fp);
-    }
 }
 
 static inline double elapsed(struct timespec const before,
@@ -139,39 +90,150 @@ int main(int argc, char* argv[argc + 1])
         print_config();
     }
 
+    // Measure the setup separately from the time loop
+    struct timespec startup_before, startup_after;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &startup_before);
+
+    // The last ranks may be reserved as I/O servers, which do no lattice work
+    if (lbm_gbl_config.io_servers >= (uint32_t)comm_size) {
+        fatal("I/O servers leave no rank to compute.");
+    }
+    int const io_server = rank >= comm_size - (int)lbm_gbl_config.io_servers;
+    MPI_Comm compute_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, io_server, rank, &compute_comm);
+    if (io_server) {
+        lbm_output_serve(compute_comm);
+        MPI_Comm_free(&compute_comm);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+    MPI_Comm_size(compute_comm, &comm_size);
+
     // Init structures, allocate memory...
     lbm_comm_t mesh_comm;
-    lbm_comm_init(&mesh_comm, rank, comm_size, MESH_WIDTH, MESH_HEIGHT);
+    lbm_comm_init(&mesh_comm, compute_comm, rank, comm_size, MESH_WIDTH,
+                  MESH_HEIGHT);
+    // The master is the first rank of the (possibly reordered) grid
+    MPI_Comm_rank(mesh_comm.comm, &rank);
 
     Mesh mesh;
     Mesh_init(&mesh, lbm_comm_width(&mesh_comm), lbm_comm_height(&mesh_comm));
 
+    // Exchanged mesh, shared with the ranks of the node if requested
     Mesh temp;
-    Mesh_init(&temp, lbm_comm_width(&mesh_comm), lbm_comm_height(&mesh_comm));
-
-    Mesh temp_render;
-    Mesh_init(&temp_render, lbm_comm_width(&mesh_comm),
-              lbm_comm_height(&mesh_comm));
+    lbm_comm_mesh_init(&mesh_comm, &temp);
 
     lbm_mesh_type_t mesh_type;
     lbm_mesh_type_t_init(&mesh_type, lbm_comm_width(&mesh_comm),
                          lbm_comm_height(&mesh_comm));
 
-    // Master open the output file
-    FILE* fp = NULL;
-    if (rank == RANK_MASTER) {
-        fp = open_output_file();
-        // Write header
-        write_file_header(fp, &mesh_comm);
-    }
+    // Open the output file and write its header
+    lbm_output_t output;
+    lbm_output_open(&output, &mesh_comm);
 
     // Setup initial conditions on mesh
-    setup_init_state(&mesh, &mesh_type, &mesh_comm);
-    setup_init_state(&temp, &mesh_type, &mesh_comm);
+    lbm_subdomain_t* subdomains = NULL;
+    int nb_subdomains = 0;
+    if (lbm_gbl_config.thread_domains || lbm_gbl_config.blocks_per_rank > 0) {
+        if (provided < MPI_THREAD_MULTIPLE) {
+            fatal("Thread subdomains require MPI_THREAD_MULTIPLE.");
+        }
+        if (mesh_comm.precision != HALO_DOUBLE) {
+            fatal("Thread subdomains only exchange double-precision halos.");
+        }
+        if (mesh_comm.nb_y > 1) {
+            fatal("Thread subdomains only split a column decomposition.");
+        }
+        if (lbm_gbl_config.thread_domains &&
+            lbm_gbl_config.blocks_per_rank > 0) {
+            fatal("Thread subdomains and blocks are exclusive.");
+        }
+    }
+    if (lbm_gbl_config.thread_domains) {
+        // Each thread allocates and initializes its own subdomain
+        subdomains = malloc(omp_get_max_threads() * sizeof(lbm_subdomain_t));
+        #pragma omp parallel
+        {
+            int const id = omp_get_thread_num();
+            #pragma omp single
+            nb_subdomains = omp_get_num_threads();
+            lbm_subdomain_split(&subdomains[id], &mesh_comm, id, nb_subdomains);
+            lbm_subdomain_init(&subdomains[id]);
+            lbm_subdomain_gather(&mesh, &mesh_comm, &subdomains[id]);
+        }
+    } else if (lbm_gbl_config.blocks_per_rank > 0) {
+        // Many more blocks than threads, scheduled dynamically
+        nb_subdomains = lbm_gbl_config.blocks_per_rank;
+        subdomains = malloc(nb_subdomains * sizeof(lbm_subdomain_t));
+        #pragma omp parallel for schedule(static)
+        for (int id = 0; id < nb_subdomains; id++) {
+            lbm_subdomain_split(&subdomains[id], &mesh_comm, id, nb_subdomains);
+            lbm_subdomain_init(&subdomains[id]);
+            lbm_subdomain_gather(&mesh, &mesh_comm, &subdomains[id]);
+        }
+    } else {
+        setup_init_state(&mesh, &mesh_type, &mesh_comm);
+        setup_init_state_copy(&temp, &mesh);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &startup_after);
+    double const local_startup_latency = elapsed(startup_before, startup_after);
+
+    // Reserve a thread for communications
+    lbm_comm_thread_t comm_thread;
+    int const nb_threads = omp_get_max_threads();
+    if (lbm_gbl_config.comm_thread) {
+        if (subdomains != NULL) {
+            fatal("Thread subdomains and communication thread are exclusive.");
+        }
+        lbm_comm_thread_init(&comm_thread, nb_threads, &mesh_comm);
+    }
+
+#if defined(THREAD_POOL)
+    // Persistent threads replace the OpenMP runtime in the time loop, the
+    // other loops would run beside the workers spinning in their barrier
+    if (subdomains != NULL || lbm_gbl_config.comm_thread ||
+        lbm_gbl_config.scheduler != SCHED_OMP || mesh_comm.ghost > 1) {
+        fatal("The thread pool only runs the default shared mesh loop.");
+    }
+    lbm_pool_t pool;
+    lbm_pool_init(&pool, mesh_comm.comm, nb_threads);
+#endif
+
+    // Measurement-driven load balancing between columns of ranks
+    lbm_balance_t balance;
+    lbm_balance_init(&balance, lbm_gbl_config.balance_interval);
+    if (balance.interval != 0 &&
+        (subdomains != NULL || lbm_gbl_config.comm_thread)) {
+        fatal("Load balancing only applies to the shared mesh loop.");
+    }
+    if (balance.interval != 0 && mesh_comm.backend == HALO_SHARED) {
+        fatal("Load balancing cannot resize shared-memory halo windows.");
+    }
+
+    // Deep halos have their own loop
+    if (mesh_comm.ghost > 1 &&
+        (subdomains != NULL || lbm_gbl_config.comm_thread ||
+         lbm_gbl_config.scheduler != SCHED_OMP || balance.interval != 0)) {
+        fatal("Deep halos only apply to the default shared mesh loop.");
+    }
+
+    // Instrumented column schedulers
+    lbm_sched_t sched;
+    if (lbm_gbl_config.scheduler != SCHED_OMP) {
+        if (subdomains != NULL || lbm_gbl_config.comm_thread) {
+            fatal("Column schedulers only apply to the shared mesh loop.");
+        }
+        // The load balancer may give this rank up to every column
+        uint32_t const max_width = (balance.interval != 0)
+                                       ? MESH_WIDTH + 2
+                                       : (uint32_t)lbm_comm_width(&mesh_comm);
+        lbm_sched_init(&sched, lbm_gbl_config.scheduler, nb_threads,
+                       lbm_gbl_config.sched_chunk, max_width);
+    }
 
     // Write initial condition in output file
     if (lbm_gbl_config.output_filename != NULL) {
-        save_frame_all_domain(fp, &mesh, &temp_render);
+        lbm_output_write_frame(&output, &mesh_comm, &mesh);
     }
 
     struct timespec overall_before, overall_after;
@@ -182,18 +244,74 @@ int main(int argc, char* argv[argc + 1])
     // Time steps
     for (ssize_t i = 1; i < ITERATIONS; i++) {
         clock_gettime(CLOCK_MONOTONIC_RAW, &loop_before);
+        if (balance.interval != 0) {
+            lbm_balance_begin_step(&balance, &mesh_comm);
+        }
 
-        #pragma omp parallel 
-        {
-            // Compute special actions (border, obstacle...)
-            special_cells(&mesh, &mesh_type, &mesh_comm);
-
-            // Compute collision term
-            collision(&temp, &mesh);
-
-            // Propagate values from node to neighboors
-            lbm_comm_ghost_exchange(&mesh_comm, &temp);
-            propagation(&mesh, &temp);
+        if (lbm_gbl_config.blocks_per_rank > 0) {
+            #pragma omp parallel
+            lbm_subdomain_blocks_step(subdomains, nb_subdomains);
+        } else if (subdomains != NULL) {
+            #pragma omp parallel num_threads(nb_subdomains)
+            lbm_subdomain_step(subdomains, omp_get_thread_num());
+        } else if (lbm_gbl_config.comm_thread) {
+            #pragma omp parallel num_threads(nb_threads)
+            lbm_comm_thread_step(&comm_thread, &mesh, &temp, &mesh_type,
+                                 &mesh_comm, &output);
+        } else if (lbm_gbl_config.scheduler != SCHED_OMP) {
+            #pragma omp parallel num_threads(nb_threads)
+            lbm_sched_step(&sched, &mesh, &temp, &mesh_type, &mesh_comm);
+        } else if (mesh_comm.ghost > 1) {
+            #pragma omp parallel
+            {
+                // Ghost layers still valid since the last exchange are
+                // collided again instead of being received
+                lbm_region_t region;
+                lbm_comm_compute_region(&mesh_comm, i, &region);
+                collision_region(&temp, &mesh, &mesh_type, &mesh_comm,
+                                 &region);
+
+                // Whole halos are only exchanged once every `ghost` steps
+                if (lbm_comm_exchanges_at(&mesh_comm, i)) {
+                    #pragma omp master
+                    lbm_comm_ghost_exchange(&mesh_comm, &temp);
+                    #pragma omp barrier
+                }
+                propagation(&mesh, &temp);
+            }
+        } else {
+#if defined(THREAD_POOL)
+            lbm_pool_step(&pool, &mesh, &temp, &mesh_type, &mesh_comm);
+#else
+            #pragma omp parallel 
+            {
+                // Compute special actions (border, obstacle...) and collision
+                // term on the boundary columns first
+                collision_boundaries(&temp, &mesh, &mesh_type, &mesh_comm);
+
+                // Send them while computing the inner columns
+                #pragma omp master
+                lbm_comm_sync_ghosts_start(&mesh_comm, &temp);
+                collision_inner(&temp, &mesh, &mesh_type, &mesh_comm);
+
+                if (lbm_comm_exchanges_rows(&mesh_comm)) {
+                    // Every column reads ghost rows, wait for them first
+                    #pragma omp master
+                    lbm_comm_sync_ghosts_wait(&mesh_comm, &temp);
+                    #pragma omp barrier
+                    propagation(&mesh, &temp);
+                } else {
+                    // Propagate values from node to neighboors, ghost columns
+                    // once received
+                    propagation_inner(&mesh, &temp);
+                    #pragma omp master
+                    {
+                        lbm_comm_sync_ghosts_wait(&mesh_comm, &temp);
+                        propagation_ghosts(&mesh, &temp);
+                    }
+                }
+            }
+#endif
         }
 
 #if defined(NO_DUMP)
@@ -201,11 +319,29 @@ int main(int argc, char* argv[argc + 1])
         clock_gettime(CLOCK_MONOTONIC_RAW, &loop_after);
         loop_latencies[i] = elapsed(loop_before, loop_after);
 #endif
+        if (balance.interval != 0) {
+            struct timespec compute_after;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &compute_after);
+            lbm_balance_end_step(&balance, &mesh_comm,
+                                 elapsed(loop_before, compute_after));
+        }
 
         // Save step
         if (i % WRITE_STEP_INTERVAL == 0 &&
             lbm_gbl_config.output_filename != NULL) {
-            save_frame_all_domain(fp, &mesh, &temp_render);
+            // Subdomains or blocks are gathered in parallel
+            if (subdomains != NULL) {
+                #pragma omp parallel for schedule(static)
+                for (int id = 0; id < nb_subdomains; id++) {
+                    lbm_subdomain_gather(&mesh, &mesh_comm, &subdomains[id]);
+                }
+            }
+            if (lbm_gbl_config.comm_thread) {
+                // Saved by the communication thread during the next step
+                lbm_comm_thread_request_frame(&comm_thread);
+            } else {
+                lbm_output_write_frame(&output, &mesh_comm, &mesh);
+            }
         }
 
 #if !defined(NO_DUMP)
@@ -213,22 +349,34 @@ int main(int argc, char* argv[argc + 1])
         clock_gettime(CLOCK_MONOTONIC_RAW, &loop_after);
         loop_latencies[i] = elapsed(loop_before, loop_after);
 #endif
+
+        // Move columns between ranks, out of the measured step
+        if (balance.interval != 0 && i % balance.interval == 0) {
+            lbm_balance_step(&balance, &mesh_comm, &mesh, &temp, &mesh_type,
+                             i);
+        }
+    }
+    if (lbm_gbl_config.comm_thread) {
+        lbm_comm_thread_flush_frame(&comm_thread, &mesh_comm, &mesh,
+                                    &output);
     }
     clock_gettime(CLOCK_MONOTONIC_RAW, &overall_after);
     double const local_latency = elapsed(overall_before, overall_after);
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(mesh_comm.comm);
     double local_avg_loop_latency = 0.0;
     for (size_t i = 0; i < ITERATIONS; ++i) {
         local_avg_loop_latency += loop_latencies[i];
     }
     local_avg_loop_latency /= ITERATIONS;
 
-    double global_avg_loop_latency, global_latency;
+    double global_avg_loop_latency, global_latency, global_startup_latency;
     MPI_Reduce(&local_avg_loop_latency, &global_avg_loop_latency, 1, MPI_DOUBLE,
-               MPI_SUM, 0, MPI_COMM_WORLD);
+               MPI_SUM, 0, mesh_comm.comm);
     MPI_Reduce(&local_latency, &global_latency, 1, MPI_DOUBLE, MPI_SUM, 0,
-               MPI_COMM_WORLD);
+               mesh_comm.comm);
+    MPI_Reduce(&local_startup_latency, &global_startup_latency, 1, MPI_DOUBLE,
+               MPI_SUM, 0, mesh_comm.comm);
 
 #if defined(NO_DUMP)
     printf("\033[1mRank \033[33m%d\033[0m: local average loop latency: "
@@ -240,8 +388,51 @@ int main(int argc, char* argv[argc + 1])
            rank, local_avg_loop_latency * 1000.0);
 #endif
     printf("\033[1mRank \033[33m%d\033[0m: local simulation latency:   "
-           "\033[36m%.9lfs\033[0m\n\n",
+           "\033[36m%.9lfs\033[0m\n",
            rank, local_latency);
+    printf("\033[1mRank \033[33m%d\033[0m: local startup latency:      "
+           "\033[36m%.9lfs\033[0m\n",
+           rank, local_startup_latency);
+    double local_overlap = 0.0, global_overlap = 0.0;
+    if (lbm_gbl_config.comm_thread) {
+        local_overlap = lbm_comm_thread_overlap(&comm_thread);
+        printf("\033[1mRank \033[33m%d\033[0m: communication overlap:      "
+               "\033[36m%.2lf%%\033[0m (%.6lfs communicating, %.6lfs "
+               "exposed)\n",
+               rank, local_overlap, comm_thread.comm_time,
+               comm_thread.exposed_time);
+    }
+    if (lbm_gbl_config.scheduler != SCHED_OMP) {
+        lbm_sched_print_stats(&sched, rank);
+    }
+    // Subdomains on the edges of the rank count their own halo messages
+    for (int i = 0; i < nb_subdomains; i++) {
+        mesh_comm.messages_sent += subdomains[i].comm.messages_sent;
+        mesh_comm.bytes_sent += subdomains[i].comm.bytes_sent;
+    }
+    lbm_comm_print_stats(&mesh_comm, rank);
+    if (balance.interval != 0) {
+        lbm_balance_print(&balance, &mesh_comm);
+    }
+    uint64_t local_halo[6] = { mesh_comm.messages_sent,
+                               mesh_comm.bytes_sent,
+                               mesh_comm.bytes_copied,
+                               mesh_comm.node_bytes[0],
+                               mesh_comm.node_bytes[1],
+                               mesh_comm.linear_node_bytes[1] };
+    uint64_t global_halo[6];
+    MPI_Reduce(&local_overlap, &global_overlap, 1, MPI_DOUBLE, MPI_SUM, 0,
+               mesh_comm.comm);
+    MPI_Reduce(local_halo, global_halo, 6, MPI_UINT64_T, MPI_SUM, 0,
+               mesh_comm.comm);
+    // Pending snapshots are written before the output is measured
+    lbm_output_close(&output);
+    double const local_output[3] = { output.time, output.stall_time,
+                                     output.write_time };
+    double global_output[3];
+    MPI_Reduce(local_output, global_output, 3, MPI_DOUBLE, MPI_SUM, 0,
+               mesh_comm.comm);
+    printf("\n");
     if (rank == RANK_MASTER) {
 #if defined(NO_DUMP)
         printf("Global average loop latency:        %.6lfms (file dump not measured)\n",
@@ -252,18 +443,68 @@ int main(int argc, char* argv[argc + 1])
 #endif
         printf("Global simulation latency:          %.9lfs\n",
                global_latency / comm_size);
-    }
-
-    if (rank == RANK_MASTER && fp != NULL) {
-        close_file(fp);
+        printf("Global startup latency:             %.9lfs\n",
+               global_startup_latency / comm_size);
+        if (lbm_gbl_config.comm_thread) {
+            printf("Global communication overlap:       %.2lf%%\n",
+                   global_overlap / comm_size);
+        }
+        printf("Global halo exchange:               %lu bytes in %lu "
+               "messages\n",
+               global_halo[1], global_halo[0]);
+        if (mesh_comm.backend == HALO_SHARED) {
+            printf("Global shared-memory halo:          %lu bytes copied\n",
+                   global_halo[2]);
+        }
+        printf("Global halo placement:              %lu bytes per exchange "
+               "within %d nodes, %lu between them (%lu if linear)\n",
+               global_halo[3], mesh_comm.nb_nodes, global_halo[4],
+               global_halo[5]);
+        double const hidden = (global_output[2] > 0.0)
+                                  ? 1.0 - global_output[1] / global_output[2]
+                                  : 0.0;
+        printf("Global frame output:                %u frames, %.6lfs "
+               "writing from %d ranks, %.6lfs in the solver (%.6lfs "
+               "stalled, %.2lf%% hidden)\n",
+               output.nb_frames, global_output[2] / comm_size,
+               output.nb_writers,
+               global_output[0] / comm_size, global_output[1] / comm_size,
+               (hidden > 0.0) ? hidden * 100.0 : 0.0);
+        if (lbm_gbl_config.output_compression != COMPRESSION_NONE) {
+            printf("Global frame compression:           %lu bytes of frames "
+                   "stored in %lu (%.2lfx)\n",
+                   output.raw_bytes, output.stored_bytes,
+                   (double)output.raw_bytes / output.stored_bytes);
+        }
+        if (lbm_gbl_config.output_compression == COMPRESSION_LOSSY) {
+            printf("Global frame error:                 %g at most, "
+                   "%g requested\n",
+                   output.max_error, lbm_gbl_config.output_error_bound);
+        }
     }
 
     // Free memory
+    if (subdomains != NULL) {
+        #pragma omp parallel for schedule(static)
+        for (int id = 0; id < nb_subdomains; id++) {
+            lbm_subdomain_release(&subdomains[id]);
+        }
+        free(subdomains);
+    }
+    if (lbm_gbl_config.comm_thread) {
+        lbm_comm_thread_release(&comm_thread);
+    }
+    if (lbm_gbl_config.scheduler != SCHED_OMP) {
+        lbm_sched_release(&sched);
+    }
+#if defined(THREAD_POOL)
+    lbm_pool_release(&pool);
+#endif
     free(loop_latencies);
+    lbm_comm_mesh_release(&mesh_comm, &temp);
     lbm_comm_release(&mesh_comm);
+    MPI_Comm_free(&compute_comm);
     Mesh_release(&mesh);
-    Mesh_release(&temp);
-    Mesh_release(&temp_render);
     lbm_mesh_type_t_release(&mesh_type);
 
     // Close MPI